@@ -0,0 +1,153 @@
+// This file is part of bingshin.
+// 
+// bingshin is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+// 
+// bingshin is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+// more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with bingshin. If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Measures how many tiles per second tilecache decodes with a growing number
+// of decoding threads. Every tile under <quadkey> at <depth> more levels that
+// exists in the repository is requested at once, and the clock stops when the
+// last one has been inserted into the cache.
+//
+//   decodebench <repository root> <quadkey> <depth> [max number of threads]
+
+#include "stdafx.h"
+
+using namespace mapctrl;
+
+namespace config
+{
+	static const unsigned int tilesize = 256;
+	static const size_t cachebytes = static_cast<size_t>(-1);
+	// no tile is loaded twice, so none of the files are kept
+	static const size_t encodedbytes = 0;
+
+	// gives up when no tile has been loaded for this long
+	static const Uint32 stalltimeout = 5000;
+}
+
+static unsigned int numloaded = 0;
+static std::unique_ptr<mutex> loadedmutex;
+
+static void on_tileloaded()
+{
+	loadedmutex->lock();
+	numloaded++;
+	loadedmutex->unlock();
+}
+
+static unsigned int get_numloaded()
+{
+	loadedmutex->lock();
+	unsigned int count = numloaded;
+	loadedmutex->unlock();
+	return count;
+}
+
+static void collect_keys(const repository &repos, const std::string &prefix, int depth, std::vector<quadkey> &keys)
+{
+	if (!depth) {
+		quadkey key(prefix);
+		if (repos.exists(key, mapcontrol::ROAD))
+			keys.push_back(key);
+		return;
+	}
+
+	for (char digit = '0'; digit <= '3'; ++digit)
+		collect_keys(repos, prefix + digit, depth - 1, keys);
+}
+
+// returns the elapsed milliseconds, or 0 if some tiles never arrived
+static Uint32 run(const std::string &rootdir, const std::vector<quadkey> &keys, unsigned int numworkers)
+{
+	numloaded = 0;
+
+	tilecache tiles(rootdir, config::tilesize, config::cachebytes, config::cachebytes, config::encodedbytes, numworkers);
+	tiles.initialize(on_tileloaded);
+
+	Uint32 start = SDL_GetTicks();
+	for (auto i = keys.begin(); i != keys.end(); ++i)
+		tiles.get_texture(*i, 1);
+
+	unsigned int lastcount = 0;
+	Uint32 lastprogress = start;
+	for (; ; ) {
+		unsigned int count = get_numloaded();
+		Uint32 now = SDL_GetTicks();
+		if (count >= keys.size())
+			return std::max<Uint32>(now - start, 1);
+
+		if (count != lastcount) {
+			lastcount = count;
+			lastprogress = now;
+		}
+		else if (now - lastprogress > config::stalltimeout) {
+			std::cerr << "only " << count << " of " << keys.size() << " tiles were loaded" << std::endl;
+			return 0;
+		}
+		SDL_Delay(1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 4 || argc > 5) {
+		std::cerr << "usage: decodebench <repository root> <quadkey> <depth> [max number of threads]" << std::endl;
+		return 1;
+	}
+
+	std::string rootdir(argv[1]);
+	std::string prefix(argv[2]);
+	int depth = std::atoi(argv[3]);
+	unsigned int maxworkers = argc == 5 ? std::atoi(argv[4]) : thread::get_numcores() * 2;
+	if (depth < 0 || maxworkers == 0) {
+		std::cerr << "invalid arguments" << std::endl;
+		return 1;
+	}
+
+	if (SDL_Init(0) < 0) {
+		std::cerr << "cannot initialize SDL" << std::endl;
+		return 1;
+	}
+	loadedmutex.reset(mutex::create());
+
+	std::vector<quadkey> keys;
+	{
+		repository repos(rootdir);
+		collect_keys(repos, prefix, depth, keys);
+	}
+	if (keys.empty()) {
+		std::cerr << "no tiles under " << prefix << std::endl;
+		return 1;
+	}
+
+	// warms up the page cache so that the first row does not pay for the disk
+	run(rootdir, keys, maxworkers);
+
+	std::cout << keys.size() << " tiles, " << thread::get_numcores() << " cores" << std::endl;
+	std::cout << std::setw(8) << "threads" << std::setw(10) << "msec" << std::setw(12) << "tiles/s" << std::setw(10) << "speedup" << std::endl;
+
+	double base = 0.0;
+	for (unsigned int numworkers = 1; numworkers <= maxworkers; numworkers = numworkers < 4 ? numworkers + 1 : numworkers * 2) {
+		Uint32 elapsed = run(rootdir, keys, numworkers);
+		if (!elapsed) return 1;
+
+		double rate = keys.size() * 1000.0 / elapsed;
+		if (numworkers == 1) base = rate;
+		std::cout << std::setw(8) << numworkers << std::setw(10) << elapsed << std::setw(12) << std::fixed << std::setprecision(1) << rate << std::setw(10) << std::setprecision(2) << rate / base << std::endl;
+	}
+
+	loadedmutex.reset();
+	SDL_Quit();
+	return 0;
+}
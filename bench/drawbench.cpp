@@ -0,0 +1,172 @@
+// This file is part of bingshin.
+// 
+// bingshin is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+// 
+// bingshin is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+// more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with bingshin. If not, see <http://www.gnu.org/licenses/>.
+// 
+
+// Compares the frame time of drawing the visible tiles one by one with
+// renderer::draw_tile against submitting whole layers with
+// renderer::draw_layer. Both a still map (one layer) and a zoom animation
+// (two scaled layers) are drawn once every tile has been loaded.
+//
+//   drawbench <repository root> <zoom level> <longitude> <latitude> [number of frames]
+
+#include "stdafx.h"
+
+using namespace mapctrl;
+
+namespace config
+{
+	static const unsigned int tilesize = 256;
+	// nothing is evicted while measuring
+	static const size_t cachebytes = static_cast<size_t>(-1);
+	// no tile is loaded twice, so none of the files are kept
+	static const size_t encodedbytes = 0;
+
+	// loading is over when no tile has arrived for this long
+	static const Uint32 settletimeout = 1000;
+
+	// uploads are not what is measured, so they are let through at once
+	static const unsigned int uploadmaxbytes = 1 << 30;
+	static const float uploadmaxseconds = 1.0f;
+}
+
+struct scene
+{
+	tilelayer mainlayer;
+	tilelayer sublayer;
+	screenpair size;
+	int timestamp;
+
+	scene(int lod, const lonlat &center, const screenpair &size)
+		: mainlayer(lod), sublayer(lod - 1), size(size), timestamp(1)
+	{
+		this->mainlayer.set_map(lod, this->mainlayer.get_pixel(center), size);
+		this->sublayer.set_map(lod - 1, this->sublayer.get_pixel(center), size);
+	}
+};
+
+static void draw_layer(renderer *render, tilecache *tiles, scene &s, const tilelayer &layer, const float *factor, bool batched)
+{
+	if (batched) {
+		render->draw_layer(s.timestamp, tiles, s.size, layer, factor, true);
+		return;
+	}
+
+	for (auto i = layer.visible(); i.movenext(); )
+		render->draw_tile(s.timestamp, tiles, s.size, layer, factor, true, i.currenttile(), i.currentpixel());
+}
+
+static void draw_frame(renderer *render, tilecache *tiles, scene &s, bool zooming, bool batched)
+{
+	s.timestamp++;
+	tiles->destroy_useless_textures();
+	tiles->upload_textures(s.timestamp, config::uploadmaxbytes, config::uploadmaxseconds);
+
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	if (zooming) {
+		// halfway through zooming in from sublayer to mainlayer
+		float subtilefactor = std::pow(2.f, 0.5f);
+		float maintilefactor = std::pow(2.f, -0.5f);
+		draw_layer(render, tiles, s, s.sublayer, &subtilefactor, batched);
+		draw_layer(render, tiles, s, s.mainlayer, &maintilefactor, batched);
+	}
+	else
+		draw_layer(render, tiles, s, s.mainlayer, nullptr, batched);
+
+	glFinish();
+	SDL_GL_SwapBuffers();
+}
+
+// returns the average milliseconds per frame
+static double run(renderer *render, tilecache *tiles, scene &s, bool zooming, bool batched, int numframes)
+{
+	Uint32 start = SDL_GetTicks();
+	for (int i = 0; i < numframes; ++i)
+		draw_frame(render, tiles, s, zooming, batched);
+	Uint32 elapsed = SDL_GetTicks() - start;
+	return static_cast<double>(elapsed) / numframes;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 5 || argc > 6) {
+		std::cerr << "usage: drawbench <repository root> <zoom level> <longitude> <latitude> [number of frames]" << std::endl;
+		return 1;
+	}
+
+	std::string rootdir(argv[1]);
+	int lod = std::atoi(argv[2]);
+	lonlat center(std::atof(argv[3]), std::atof(argv[4]));
+	int numframes = argc == 6 ? std::atoi(argv[5]) : 300;
+	if (lod < 2 || numframes <= 0) {
+		std::cerr << "invalid arguments" << std::endl;
+		return 1;
+	}
+
+	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+		std::cerr << "cannot initialize SDL" << std::endl;
+		return 1;
+	}
+
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 1);
+	SDL_Surface *screen = SDL_SetVideoMode(0, 0, 0, SDL_OPENGL);
+	if (!screen) {
+		std::cerr << "cannot create an OpenGL surface" << std::endl;
+		SDL_Quit();
+		return 1;
+	}
+	screenpair size(screen->w, screen->h);
+
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrthof(0.0f, static_cast<float>(size.x), static_cast<float>(size.y), 0.0f, -1.0f, 1.0f);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_LIGHTING);
+	glEnable(GL_TEXTURE_2D);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDisable(GL_ALPHA_TEST);
+
+	{
+		tilecache tiles(rootdir, config::tilesize, config::cachebytes, config::cachebytes, config::encodedbytes);
+		tiles.initialize(nullptr);
+		std::unique_ptr<renderer> render(renderer::create(static_cast<short>(config::tilesize)));
+		scene s(lod, center, size);
+
+		// keeps drawing until every tile of both layers has been decoded and bound
+		Uint32 lastloaded = SDL_GetTicks();
+		while (SDL_GetTicks() - lastloaded < config::settletimeout) {
+			tiles.clear_dirty();
+			draw_frame(render.get(), &tiles, s, true, true);
+			SDL_Delay(10);
+			if (tiles.is_dirty())
+				lastloaded = SDL_GetTicks();
+		}
+
+		std::cout << size.x << "x" << size.y << ", " << numframes << " frames" << std::endl;
+		std::cout << std::setw(10) << "scene" << std::setw(12) << "per tile" << std::setw(12) << "batched" << std::setw(10) << "speedup" << std::endl;
+
+		for (int zooming = 0; zooming < 2; ++zooming) {
+			double pertile = run(render.get(), &tiles, s, zooming != 0, false, numframes);
+			double batched = run(render.get(), &tiles, s, zooming != 0, true, numframes);
+			std::cout << std::setw(10) << (zooming ? "zooming" : "still") << std::fixed << std::setprecision(2) << std::setw(12) << pertile << std::setw(12) << batched << std::setw(10) << pertile / batched << std::endl;
+		}
+	}
+
+	SDL_Quit();
+	return 0;
+}
@@ -0,0 +1,183 @@
+// This file is part of bingshin.
+//
+// bingshin is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// bingshin is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+// more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bingshin. If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Compares the tile indexes tilecache can be built with: quadtrie taking its
+// nodes one by one from the heap, quadtrie taking them from its own pool, and
+// quadtable. The keys are those a map panning over the same area at one zoom
+// level asks for: each frame searches the visible tiles and inserts the ones
+// that are missing, evicting the coldest tiles first whenever the new one
+// would not fit in the budget, as tilecache does. Insertion, search and
+// sweeping are timed on their own as well, and so is searching for the tiles
+// two levels down, which are not there and fall back to the ones inserted.
+//
+//   triebench [number of frames]
+
+#include "stdafx.h"
+
+using namespace mapctrl;
+
+namespace config
+{
+	static const int zoomlevel = 15;
+	static const int screentilesx = 5;
+	static const int screentilesy = 4;
+	static const size_t tilebytes = 256 * 256 * 4;
+	static const size_t cachebytes = 200 * tilebytes;
+	static const int numrepeats = 20;
+}
+
+// stands in for pngtexture_queued
+struct payload
+{
+	payload(int value)
+		: value(value)
+	{
+	}
+
+	int value;
+};
+
+// the visible tiles of every frame of a pan that wanders back and forth
+static std::vector<std::vector<quadkey>> make_frames(int numframes)
+{
+	std::vector<std::vector<quadkey>> frames;
+	std::srand(1);
+
+	tilelayer layer(config::zoomlevel);
+
+	tilepair origin(1 << (config::zoomlevel - 1), 1 << (config::zoomlevel - 1));
+	int x = 0, y = 0;
+	for (int f = 0; f < numframes; ++f) {
+		x += std::rand() % 3 - 1;
+		y += std::rand() % 3 - 1;
+
+		std::vector<quadkey> visible;
+		for (int j = 0; j < config::screentilesy; ++j) {
+			for (int i = 0; i < config::screentilesx; ++i)
+				visible.push_back(layer.get_quadkey(tilepair(origin.x + x + i, origin.y + y + j)));
+		}
+		frames.push_back(visible);
+	}
+	return frames;
+}
+
+template<typename trie>
+struct scenario
+{
+	// returns the milliseconds the whole pan took
+	static Uint32 pan(const std::vector<std::vector<quadkey>> &frames)
+	{
+		Uint32 start = SDL_GetTicks();
+		for (int r = 0; r < config::numrepeats; ++r) {
+			trie t;
+			int timestamp = 0;
+			for (auto f = frames.begin(); f != frames.end(); ++f) {
+				++timestamp;
+				for (auto k = f->begin(); k != f->end(); ++k) {
+					if (t.search(*k, timestamp).first) continue;
+
+					t.evict(config::cachebytes - config::tilebytes, timestamp);
+					t.insert(*k, new payload(timestamp), timestamp, config::tilebytes);
+				}
+			}
+		}
+		return SDL_GetTicks() - start;
+	}
+
+	// returns the milliseconds spent inserting, searching, falling back and sweeping every key once
+	static std::vector<Uint32> phases(const std::vector<quadkey> &keys, const std::vector<quadkey> &subkeys)
+	{
+		std::vector<Uint32> elapsed(4, 0);
+		for (int r = 0; r < config::numrepeats; ++r) {
+			trie t;
+
+			Uint32 start = SDL_GetTicks();
+			for (size_t i = 0; i < keys.size(); ++i)
+				t.insert(keys[i], new payload(static_cast<int>(i)), 1);
+			elapsed[0] += SDL_GetTicks() - start;
+
+			// every other key is searched again later, so that the sweep keeps half
+			start = SDL_GetTicks();
+			for (size_t i = 0; i < keys.size(); ++i)
+				t.search(keys[i], i % 2 ? 2 : 1);
+			elapsed[1] += SDL_GetTicks() - start;
+
+			start = SDL_GetTicks();
+			for (size_t i = 0; i < subkeys.size(); ++i)
+				t.search(subkeys[i], 2);
+			elapsed[2] += SDL_GetTicks() - start;
+
+			start = SDL_GetTicks();
+			t.sweep(2);
+			t.sweep(3);
+			elapsed[3] += SDL_GetTicks() - start;
+		}
+		return elapsed;
+	}
+};
+
+int main(int argc, char **argv)
+{
+	if (argc > 2) {
+		std::cerr << "usage: triebench [number of frames]" << std::endl;
+		return 1;
+	}
+
+	int numframes = argc == 2 ? std::atoi(argv[1]) : 20000;
+	if (numframes <= 0) {
+		std::cerr << "invalid arguments" << std::endl;
+		return 1;
+	}
+
+	if (SDL_Init(SDL_INIT_TIMER) < 0) {
+		std::cerr << "cannot initialize SDL" << std::endl;
+		return 1;
+	}
+
+	auto frames = make_frames(numframes);
+
+	std::set<quadkey> unique;
+	for (auto f = frames.begin(); f != frames.end(); ++f)
+		unique.insert(f->begin(), f->end());
+	std::vector<quadkey> keys(unique.begin(), unique.end());
+	std::random_shuffle(keys.begin(), keys.end());
+
+	std::vector<quadkey> subkeys;
+	for (auto k = keys.begin(); k != keys.end(); ++k)
+		subkeys.push_back(k->concat(quadkey("30")));
+
+	std::vector<Uint32> results[3];
+	results[0] = scenario<quadtrie<payload, heapnodes>>::phases(keys, subkeys);
+	results[0].insert(results[0].begin(), scenario<quadtrie<payload, heapnodes>>::pan(frames));
+	results[1] = scenario<quadtrie<payload, poolednodes>>::phases(keys, subkeys);
+	results[1].insert(results[1].begin(), scenario<quadtrie<payload, poolednodes>>::pan(frames));
+	results[2] = scenario<quadtable<payload>>::phases(keys, subkeys);
+	results[2].insert(results[2].begin(), scenario<quadtable<payload>>::pan(frames));
+
+	std::cout << numframes << " frames, " << keys.size() << " distinct tiles, " << config::numrepeats << " repeats" << std::endl;
+	std::cout << std::setw(10) << "ms" << std::setw(10) << "heap" << std::setw(10) << "pooled" << std::setw(10) << "table" << std::endl;
+
+	const char *names[] = { "pan", "insert", "search", "fallback", "sweep" };
+	for (int i = 0; i < 5; ++i) {
+		std::cout << std::setw(10) << names[i];
+		for (int j = 0; j < 3; ++j)
+			std::cout << std::setw(10) << results[j][i];
+		std::cout << std::endl;
+	}
+
+	SDL_Quit();
+	return 0;
+}
@@ -379,8 +379,10 @@ public WPFMapControl()
 			int height = 600;
 			double lon = -88.228411;
 			double lat = 40.110539;
-			int numtileslimit = 100;
-			this.Initialize(reposroot, zoomlevel, width, height, lon, lat, numtileslimit);
+			int cachebytes = 25 << 20;
+			int texturebytes = 16 << 20;
+			int encodedbytes = 8 << 20;
+			this.Initialize(reposroot, zoomlevel, width, height, lon, lat, cachebytes, texturebytes, encodedbytes);
 
 			var panel = this.ContentGrid;
 
@@ -0,0 +1,81 @@
+// This file is part of bingshin.
+// 
+// bingshin is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+// 
+// bingshin is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+// more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with bingshin. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+// On-disk layout of a packed tile archive. There is one archive per style and
+// LOD, so that each file stays small enough to be mapped on 32-bit devices.
+//
+//   header | entry[numentries] (sorted by key) | tile data
+//
+// Entries are fixed-size and sorted by the packed quadkey, so a lookup is a
+// binary search over the mapped index. Several entries may share the same
+// data when their contents are identical. All the fields are little-endian.
+//
+// An index-only archive (flags & INDEXONLY) lists the tiles of a loose LOD
+// and holds just the sorted keys, with no entries and no data:
+//
+//   header | uint64 key[numentries]
+namespace archive
+{
+#ifdef _WIN32
+	typedef unsigned __int64 uint64;
+#else
+	typedef uint64_t uint64;
+#endif
+
+	static const char signature[4] = { 'B', 'S', 'P', 'K' };
+	static const unsigned int version = 1;
+
+	enum flag
+	{
+		INDEXONLY = 1,
+	};
+
+	struct header
+	{
+		char signature[4];
+		unsigned int version;
+		unsigned int lod;
+		unsigned int style;
+		unsigned int numentries;
+		unsigned int flags;
+		uint64 dataoffset;
+	};
+
+	struct entry
+	{
+		uint64 key;
+		uint64 offset;
+		unsigned int size;
+		unsigned int reserved;
+	};
+
+	inline bool operator<(const entry &l, const entry &r)
+	{
+		return l.key < r.key;
+	}
+
+	// style is the same code used by the loose file names ('r' or 'h')
+	inline std::string get_filename(char style, int lod, bool indexonly = false)
+	{
+		std::ostringstream s;
+		s << style << lod << (indexonly ? ".idx" : ".pack");
+		return s.str();
+	}
+
+	static const char dirname[] = "packs";
+}
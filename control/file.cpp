@@ -42,3 +42,71 @@ bool file::exists(const std::string &abspath)
 	return stat(abspath.c_str(), &st) == 0;
 }
 #endif
+
+#if defined PLATFORM_WIN32 || defined PLATFORM_CLR
+mappedfile::mappedfile()
+	: filehandle(INVALID_HANDLE_VALUE), maphandle(nullptr), data(nullptr), size(0)
+{
+}
+
+mappedfile::~mappedfile()
+{
+	if (this->data) ::UnmapViewOfFile(this->data);
+	if (this->maphandle) ::CloseHandle(this->maphandle);
+	if (this->filehandle != INVALID_HANDLE_VALUE) ::CloseHandle(this->filehandle);
+}
+
+mappedfile * mappedfile::open(const std::string &abspath)
+{
+	std::unique_ptr<mappedfile> mapped(new mappedfile());
+
+	mapped->filehandle = ::CreateFileA(abspath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (mapped->filehandle == INVALID_HANDLE_VALUE) return nullptr;
+
+	LARGE_INTEGER filesize;
+	if (!::GetFileSizeEx(mapped->filehandle, &filesize) || filesize.QuadPart == 0) return nullptr;
+	if (static_cast<unsigned __int64>(filesize.QuadPart) > static_cast<size_t>(-1)) return nullptr;
+
+	mapped->maphandle = ::CreateFileMappingA(mapped->filehandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapped->maphandle) return nullptr;
+
+	mapped->data = static_cast<const unsigned char *>(::MapViewOfFile(mapped->maphandle, FILE_MAP_READ, 0, 0, 0));
+	if (!mapped->data) return nullptr;
+
+	mapped->size = static_cast<size_t>(filesize.QuadPart);
+	return mapped.release();
+}
+#else
+mappedfile::mappedfile()
+	: data(nullptr), size(0)
+{
+}
+
+mappedfile::~mappedfile()
+{
+	if (this->data)
+		munmap(const_cast<unsigned char *>(this->data), this->size);
+}
+
+mappedfile * mappedfile::open(const std::string &abspath)
+{
+	int fd = ::open(abspath.c_str(), O_RDONLY);
+	if (fd < 0) return nullptr;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0 || static_cast<unsigned long long>(st.st_size) > static_cast<size_t>(-1)) {
+		close(fd);
+		return nullptr;
+	}
+
+	size_t size = static_cast<size_t>(st.st_size);
+	void *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) return nullptr;
+
+	std::unique_ptr<mappedfile> mapped(new mappedfile());
+	mapped->data = static_cast<const unsigned char *>(addr);
+	mapped->size = size;
+	return mapped.release();
+}
+#endif
@@ -30,3 +30,32 @@ struct file
 {
 	static bool exists(const std::string &abspath);
 };
+
+class mappedfile
+{
+public:
+	static mappedfile * open(const std::string &abspath);
+	~mappedfile();
+
+	const unsigned char * get_data() const
+	{
+		return this->data;
+	}
+
+	size_t get_size() const
+	{
+		return this->size;
+	}
+
+private:
+#if defined PLATFORM_WIN32 || defined PLATFORM_CLR
+	HANDLE filehandle;
+	HANDLE maphandle;
+#endif
+	const unsigned char *data;
+	size_t size;
+
+	mappedfile();
+	mappedfile(const mappedfile &r);
+	mappedfile & operator=(const mappedfile &r);
+};
@@ -66,4 +66,5 @@ namespace logger
 #endif
 
 #include "file.h"
+#include "archive.h"
 #include "repository.h"
@@ -33,12 +33,20 @@ namespace config
 		static const float zoom_duration = 0.3f;
 		static const float fly_zoom_duration_factor = 0.3f;
 		static const float fly_move_duration_factor = 0.2f;
+		static const int move_prefetch_maxsamples = 16;
+		static const int fly_prefetch_maxsamples = 16;
+		static const unsigned int upload_maxbytes = 16 * 256 * 256 * 4;
+		static const float upload_maxseconds = 0.004f;
 #else
 		static const float move_inertia_duration = 0.5f;
 		static const float move_inertia_mindeltat = 0.1f;
 		static const float zoom_duration = 0.3f;
 		static const float fly_zoom_duration_factor = 0.3f;
 		static const float fly_move_duration_factor = 0.2f;
+		static const int move_prefetch_maxsamples = 8;
+		static const int fly_prefetch_maxsamples = 8;
+		static const unsigned int upload_maxbytes = 2 * 256 * 256 * 4;
+		static const float upload_maxseconds = 0.008f;
 #endif
 	};
 }
@@ -264,6 +272,11 @@ public:
         SDL_CondSignal(this->sdlcond);
     }
 
+    virtual void broadcast()
+    {
+        SDL_CondBroadcast(this->sdlcond);
+    }
+
     virtual void wait(mutex &mut)
     {
 		SDL_CondWait(this->sdlcond, mut.get_mutex());
@@ -287,6 +300,11 @@ public:
 		::WakeConditionVariable(&this->cv);
     }
 
+    virtual void broadcast()
+    {
+		::WakeAllConditionVariable(&this->cv);
+    }
+
     virtual void wait(mutex &mut)
     {
 		::SleepConditionVariableCS(&this->cv, mut.get_mutex(), INFINITE);
@@ -310,6 +328,11 @@ public:
     {
         pthread_cond_signal(&this->pthcond);
     }
+
+    virtual void broadcast()
+    {
+        pthread_cond_broadcast(&this->pthcond);
+    }
     
     virtual void wait(mutex &mut)
     {
@@ -387,6 +410,18 @@ thread * thread::create(int (*entry)(void *data), void *data)
 }
 #endif
 
+unsigned int thread::get_numcores()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	::GetSystemInfo(&info);
+	long numcores = info.dwNumberOfProcessors;
+#else
+	long numcores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return numcores > 0 ? static_cast<unsigned int>(numcores) : 1;
+}
+
 condvar * condvar::create()
 {
     return new condvar_impl();
@@ -515,19 +550,20 @@ struct moving
 		return this->tracking;
 	}
 
+	// how far the map has moved at t seconds after the release
+	screenpair get_inertia_location(float t) const
+	{
+		float x = -0.5f * this->speed.first / config::control::move_inertia_duration * t * t + this->speed.first * t;
+		float y = -0.5f * this->speed.second / config::control::move_inertia_duration * t * t + this->speed.second * t;
+		return screenpair(static_cast<int>(x), static_cast<int>(y));
+	}
+
 private:
 	progresstimer_impl timer;
 	bool tracking;
 	std::pair<float, screenpair> lastmove;
 	std::pair<float, float> speed;
 	float releasetime;
-
-	screenpair get_inertia_location(float t)
-	{
-		float x = -0.5f * this->speed.first / config::control::move_inertia_duration * t * t + this->speed.first * t;
-		float y = -0.5f * this->speed.second / config::control::move_inertia_duration * t * t + this->speed.second * t;
-		return screenpair(static_cast<int>(x), static_cast<int>(y));
-	}
 };
 
 struct zooming
@@ -643,6 +679,27 @@ struct flying
 		return this->state != 0;
 	}
 
+	// the layers shown after the first zoom, along the move about one tile
+	// apart, and at the destination
+	void get_route(std::vector<tilelayer> &route) const
+	{
+		auto &srcnw = this->layers[1].get_pixelnw();
+		auto &destnw = this->layers[2].get_pixelnw();
+		int numsamples = static_cast<int>(std::ceil(this->calculate_tiledist(this->layers[1], this->layers[2])));
+		numsamples = std::min(numsamples, config::control::fly_prefetch_maxsamples);
+
+		route.push_back(this->layers[1]);
+		for (int i = 1; i <= numsamples; ++i) {
+			float progress = static_cast<float>(i) / numsamples;
+			auto sample = this->layers[1];
+			int deltax = static_cast<int>((destnw.x - srcnw.x) * progress);
+			int deltay = static_cast<int>((destnw.y - srcnw.y) * progress);
+			sample.move_map(screenpair(deltax, deltay));
+			route.push_back(sample);
+		}
+		route.push_back(this->layers[3]);
+	}
+
 private:
 	progresstimer_impl timer;
 	int state;
@@ -988,10 +1045,10 @@ private:
 class mapcontrol_impl : public mapcontrol
 {
 public:
-	mapcontrol_impl(const std::string &reposroot, int zoomlevel, const screenpair &size, unsigned int numtileslimit)
+	mapcontrol_impl(const std::string &reposroot, int zoomlevel, const screenpair &size, size_t cachebytes, size_t texturebytes, size_t encodedbytes)
 		: mainlayer(zoomlevel), sublayer(0), size(size), timestamp(1), dirty(true), showtilekeys(false)
 	{
-		this->tiles.reset(new tilecache(reposroot, this->mainlayer.get_tilesize(), numtileslimit));
+		this->tiles.reset(new tilecache(reposroot, this->mainlayer.get_tilesize(), cachebytes, texturebytes, encodedbytes));
 
 		auto tilesize = static_cast<short>(this->mainlayer.get_tilesize());
 		this->render.reset(renderer::create(tilesize));
@@ -1022,7 +1079,7 @@ public:
 			break;
 		case SDL_MOUSEBUTTONUP:
 			if (evt.motion.which == 0 && evt.button.button == SDL_BUTTON_LEFT)
-				this->move.second.release();
+				this->release_move();
 			break;
 		case SDL_MOUSEMOTION:
 			if (this->move.second.is_tracking())
@@ -1069,12 +1126,12 @@ public:
 	}
 #endif
 
-#ifdef PLATFORM_CLR
 	virtual renderer * get_renderer()
 	{
 		return this->render.get();
 	}
 
+#ifdef PLATFORM_CLR
 	virtual void tick()
 	{
 		if (this->move.second.is_active()) {
@@ -1098,7 +1155,7 @@ public:
 
 	virtual void handle_mouserelease()
 	{
-		this->move.second.release();
+		this->release_move();
 	}
 
 	virtual void handle_zooming(int delta)
@@ -1111,10 +1168,19 @@ public:
 
 	virtual void draw()
 	{
+		// panning only shifts the base layer, so the renderer may scroll what it
+		// drew before as long as no tile has come in since
+		if (this->tiles->is_dirty())
+			this->render->invalidate();
+		this->render->set_scrolling(this->move.second.is_active());
 		this->tiles->clear_dirty();
 
 		this->timestamp++;
+		this->render->begin_frame(this->size);
 		this->tiles->destroy_useless_textures();
+		if (this->tiles->upload_textures(this->timestamp, config::control::upload_maxbytes, config::control::upload_maxseconds))
+			this->render->invalidate();
+		this->tiles->set_focus(this->mainlayer.get_zoomlevel(), this->get_pixelcenter(), this->timestamp);
 		bool complete = this->draw_layers();
 
 #ifdef IMPLEMENT_GPSPIN
@@ -1186,11 +1252,7 @@ public:
 
 	virtual lonlat get_center() const
 	{
-		auto nw = this->mainlayer.get_pixelnw();
-		auto se = this->mainlayer.get_pixelse();
-		pixelpair pixcenter((nw.x + se.x) / 2, (nw.y + se.y) / 2);
-
-		return this->mainlayer.get_lonlat(pixcenter);
+		return this->mainlayer.get_lonlat(this->get_pixelcenter());
 	}
 
 	virtual const lonlat * get_gps() const
@@ -1278,6 +1340,10 @@ public:
 	virtual void animate_to(int destlod, const lonlat &destll)
 	{
 		this->fly.second.start(this->mainlayer, destlod, destll, this->size);
+
+		std::vector<tilelayer> route;
+		this->fly.second.get_route(route);
+		this->prefetch_layers(route);
 	}
 #endif
 
@@ -1308,6 +1374,7 @@ private:
 
 		this->sublayer = this->mainlayer;
 		this->mainlayer.zoom_map(delta);
+		this->prefetch_layers(std::vector<tilelayer>(1, this->mainlayer));
 
 		this->dirty = true;
 	}
@@ -1319,6 +1386,55 @@ private:
 		this->dirty = true;
 	}
 
+	void release_move()
+	{
+		this->move.second.release();
+		this->prefetch_inertia();
+	}
+
+	// enqueues the tiles that the fling will show before it stops
+	void prefetch_inertia()
+	{
+		auto total = this->move.second.get_inertia_location(config::control::move_inertia_duration);
+		int distance = std::max(std::abs(total.x), std::abs(total.y));
+		if (!distance) return;
+
+		int step = static_cast<int>(this->mainlayer.get_tilesize()) / 2;
+		int numsamples = std::min((distance + step - 1) / step, config::control::move_prefetch_maxsamples);
+
+		std::vector<tilelayer> predicted;
+		for (int i = 1; i <= numsamples; ++i) {
+			float t = config::control::move_inertia_duration * i / numsamples;
+			predicted.push_back(this->mainlayer);
+			predicted.back().move_map(this->move.second.get_inertia_location(t));
+		}
+
+		this->prefetch_layers(predicted);
+	}
+
+	// enqueues the visible tiles of the layers ahead of drawing them
+	void prefetch_layers(const std::vector<tilelayer> &layers)
+	{
+		std::set<quadkey> found;
+		std::vector<quadkey> keys;
+		for (auto i = layers.begin(); i != layers.end(); ++i) {
+			for (auto j = i->visible(); j.movenext(); ) {
+				auto key = i->get_quadkey(j.currenttile());
+				if (found.insert(key).second)
+					keys.push_back(key);
+			}
+		}
+
+		this->tiles->prefetch(keys, this->timestamp);
+	}
+
+	pixelpair get_pixelcenter() const
+	{
+		auto nw = this->mainlayer.get_pixelnw();
+		auto se = this->mainlayer.get_pixelse();
+		return pixelpair((nw.x + se.x) / 2, (nw.y + se.y) / 2);
+	}
+
 	void trycall_eventhandler(std::pair<bool, moving> &move, bool active)
 	{
 		if (active && !move.first) {
@@ -1407,19 +1523,62 @@ private:
 		float subtilefactor = std::pow(scale, progress);
 		float maintilefactor = std::pow(scale, progress - 1);
 
+		// the finer layer goes on top, and whatever it covers of the coarser one is not drawn
 		const float showdetailedafter = 0.8f;
 		const float showdetaileduntil = 0.08f;
+		std::set<quadkey> hidden;
 		if (difflevel > 0) {
-			this->draw_layer(srclayer, &subtilefactor, true);
-			this->draw_layer(destlayer, &maintilefactor, progress > showdetailedafter);
+			bool showdetailed = progress > showdetailedafter;
+			if (showdetailed)
+				this->get_coveredtiles(srclayer, destlayer, hidden);
+			this->draw_layer(srclayer, &subtilefactor, true, &hidden);
+			this->draw_layer(destlayer, &maintilefactor, showdetailed);
 		}
 		else {
-			this->draw_layer(destlayer, &maintilefactor, true);
-			this->draw_layer(srclayer, &subtilefactor, progress < showdetaileduntil);
+			bool showdetailed = progress < showdetaileduntil;
+			if (showdetailed)
+				this->get_coveredtiles(destlayer, srclayer, hidden);
+			this->draw_layer(destlayer, &maintilefactor, true, &hidden);
+			this->draw_layer(srclayer, &subtilefactor, showdetailed);
+
+			// the destination is still needed once the animation is over
+			std::vector<quadkey> keys(hidden.begin(), hidden.end());
+			std::vector<std::pair<quadkey, const pngtexture *>> found;
+			this->tiles->get_textures(keys, this->timestamp, found);
 		}
 	}
 
-	void draw_layer(const tilelayer &layer, const float *factor, bool draw)
+	// the tiles of the coarser layer whose finer tiles are all loaded; map tiles
+	// are opaque, so nothing of them would show through
+	void get_coveredtiles(const tilelayer &coarser, const tilelayer &finer, std::set<quadkey> &covered)
+	{
+		int difflevel = finer.get_zoomlevel() - coarser.get_zoomlevel();
+		if (difflevel <= 0 || difflevel >= 16) return;
+
+		std::vector<quadkey> keys;
+		for (auto i = finer.visible(); i.movenext(); )
+			keys.push_back(finer.get_quadkey(i.currenttile()));
+		std::vector<std::pair<quadkey, const pngtexture *>> found;
+		this->tiles->get_textures(keys, this->timestamp, found);
+
+		std::set<quadkey> loaded;
+		for (size_t i = 0; i < keys.size(); ++i) {
+			if (found[i].second && found[i].first == keys[i])
+				loaded.insert(keys[i]);
+		}
+
+		const unsigned int numchildren = 1U << (difflevel * 2);
+		std::map<quadkey, unsigned int> numloaded;
+		for (auto i = loaded.begin(); i != loaded.end(); ++i) {
+			auto ancestor = *i;
+			for (int j = 0; j < difflevel; ++j)
+				ancestor = ancestor.upper();
+			if (++numloaded[ancestor] == numchildren)
+				covered.insert(ancestor);
+		}
+	}
+
+	void draw_layer(const tilelayer &layer, const float *factor, bool draw, const std::set<quadkey> *hidden = nullptr)
 	{
 		if (this->showtilekeys) {
 #ifdef LOGGING_VISIBLETILES
@@ -1427,11 +1586,7 @@ private:
 #endif
 		}
 
-		for (auto i = layer.visible(); i.movenext(); ) {
-			auto tile = i.currenttile();
-			auto pixel = i.currentpixel();
-			this->render->draw_tile(this->timestamp, this->tiles.get(), this->size, layer, factor, draw, tile, pixel);
-		}
+		this->render->draw_layer(this->timestamp, this->tiles.get(), this->size, layer, factor, draw, hidden);
 
 		this->showtilekeys = false;
 	}
@@ -1589,7 +1744,7 @@ private:
 	}
 };
 
-mapcontrol * mapcontrol::create(const std::string &reposroot, int zoomlevel, const screenpair &size, unsigned int numtileslimit)
+mapcontrol * mapcontrol::create(const std::string &reposroot, int zoomlevel, const screenpair &size, size_t cachebytes, size_t texturebytes, size_t encodedbytes)
 {
-	return new mapcontrol_impl(reposroot, zoomlevel, size, numtileslimit);
+	return new mapcontrol_impl(reposroot, zoomlevel, size, cachebytes, texturebytes, encodedbytes);
 }
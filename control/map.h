@@ -86,6 +86,7 @@ struct CONTROL_API condvar
     }
     
     virtual void signal() = 0;
+    virtual void broadcast() = 0;
     virtual void wait(mutex &mut) = 0;
         
     static condvar * create();
@@ -104,6 +105,7 @@ struct CONTROL_API thread
 #else
 	static thread * create(int (*entry)(void *data), void *data);
 #endif
+	static unsigned int get_numcores();
 };
 
 struct CONTROL_API mapcontrol
@@ -128,9 +130,9 @@ struct CONTROL_API mapcontrol
 	virtual void move_map(int deltax, int deltay) = 0;
 #endif
 
-#ifdef PLATFORM_CLR
 	virtual renderer * get_renderer() = 0;
 
+#ifdef PLATFORM_CLR
 	virtual void tick() = 0;
 
 	virtual void handle_mousepress() = 0;
@@ -164,7 +166,10 @@ struct CONTROL_API mapcontrol
 	virtual void animate_to(int destlod, const lonlat &destll) = 0;
 #endif
 
-	static mapcontrol * create(const std::string &reposroot, int zoomlevel, const screenpair &size, unsigned int numtileslimit);
+	// cachebytes is how much memory the cached tiles may take, and texturebytes
+	// how much of it may also be held as textures; encodedbytes is how much the
+	// tile files may take as read, to be decoded again without reading them
+	static mapcontrol * create(const std::string &reposroot, int zoomlevel, const screenpair &size, size_t cachebytes, size_t texturebytes, size_t encodedbytes);
 };
 
 }
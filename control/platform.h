@@ -16,8 +16,10 @@
 
 #pragma once
 
-// Detect the platform
-#ifdef _WIN32
+// Detect the platform; define HEADLESS to build for a POSIX system without a GPU
+#ifdef HEADLESS
+#define PLATFORM_HEADLESS
+#elif defined _WIN32
 #ifdef _MANAGED
 #define PLATFORM_CLR
 #else
@@ -30,12 +32,16 @@
 #endif
 
 // Set platform-specific configuration
-#if defined PLATFORM_WIN32 || defined PLATFORM_WEBOS
+#if defined PLATFORM_WIN32 || defined PLATFORM_WEBOS || defined PLATFORM_HEADLESS
 #define USE_SDL
 #endif
 #if defined PLATFORM_WIN32 || defined PLATFORM_IOS || defined PLATFORM_WEBOS
 #define USE_OPENGL
 #endif
+// USE_GLES2 may be defined by the build to draw with OpenGL ES 2 shaders,
+// in which case the application must create an OpenGL ES 2 context
+// USE_QUADTABLE may be defined by the build to index the cached tiles with
+// quadtable instead of quadtrie
 
 // Decide features to implement
 #if defined PLATFORM_WIN32 || defined PLATFORM_IOS || defined PLATFORM_WEBOS
@@ -27,6 +27,11 @@
 #include <map>
 #include <iostream>
 #include <set>
+#include <algorithm>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
 
 
 #if defined PLATFORM_WIN32 || defined PLATFORM_CLR
@@ -35,11 +40,13 @@
 #include <windows.h>
 #include <process.h>
 #endif
-#if defined PLATFORM_IOS || defined PLATFORM_WEBOS
+#if defined PLATFORM_IOS || defined PLATFORM_WEBOS || defined PLATFORM_HEADLESS
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #endif
 
 #if defined PLATFORM_CLR
@@ -57,6 +64,9 @@
 #include "SDL.h"
 #include "SDL_image.h"
 #include "SDL_thread.h"
+#endif
+
+#if defined USE_SDL && defined USE_OPENGL
 #ifdef PLATFORM_IOS
 #include <OpenGLES/ES1/gl.h>
 #include <OpenGLES/ES1/glext.h>
@@ -66,6 +76,20 @@
 #endif
 #endif
 
+#ifdef USE_GLES2
+#ifdef PLATFORM_IOS
+#include <OpenGLES/ES2/gl.h>
+#include <OpenGLES/ES2/glext.h>
+#else
+#include "GLES2/gl2.h"
+#include "GLES2/gl2ext.h"
+#endif
+#endif
+
+#if defined PLATFORM_HEADLESS && defined __SSE2__
+#include <emmintrin.h>
+#endif
+
 // Set compiler-specific pragmas, macros and so on
 #ifdef _MSC_VER
 #pragma warning(disable:4512)
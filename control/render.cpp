@@ -16,11 +16,6 @@
 
 #include "stdafx.h"
 
-namespace config
-{
-	static bool showwireframe = false;
-}
-
 #ifdef PLATFORM_CLR
 using namespace System;
 using namespace System::IO;
@@ -38,7 +33,14 @@ public:
 		auto pathm = gcnew System::String(path.c_str());
 		if (!System::IO::File::Exists(pathm)) return nullptr;
 
-		return new wpf_pngtexture(pathm);
+		return new wpf_pngtexture(File::ReadAllBytes(pathm));
+	}
+
+	static wpf_pngtexture * load(tilecache *enclosing, const void *data, unsigned int size)
+	{
+		auto bytes = gcnew array<Byte>(size);
+		System::Runtime::InteropServices::Marshal::Copy(IntPtr(const_cast<void *>(data)), bytes, 0, size);
+		return new wpf_pngtexture(bytes);
 	}
 
 	virtual ~wpf_pngtexture()
@@ -63,9 +65,33 @@ public:
 		bitmap->EndInit();
 
 		this->imgsrc = bitmap;
+		this->numpixelbytes = bitmap->PixelWidth * bitmap->PixelHeight * 4;
 		this->bound = true;
 	}
 
+	// the encoded image is all that is kept, and it is decoded again on bind()
+	virtual void unbind()
+	{
+		this->imgsrc.reset();
+		this->imgbuffer->Position = 0;
+		this->bound = false;
+	}
+
+	virtual unsigned int get_numbytes() const
+	{
+		return this->bound ? 0 : static_cast<unsigned int>(this->imgbuffer->Length);
+	}
+
+	virtual unsigned int get_numresidentbytes() const
+	{
+		return static_cast<unsigned int>(this->imgbuffer->Length);
+	}
+
+	virtual unsigned int get_numboundbytes() const
+	{
+		return this->bound ? this->numpixelbytes : 0;
+	}
+
 	virtual ImageSource^ get_tex() const
 	{
 		return this->imgsrc.get();
@@ -75,12 +101,11 @@ private:
 	msclr::auto_gcroot<MemoryStream^> imgbuffer;
 	bool bound;
 	msclr::auto_gcroot<ImageSource^> imgsrc;
+	unsigned int numpixelbytes;
 
-	wpf_pngtexture(String^ imgpath)
-		: bound(false)
+	wpf_pngtexture(array<Byte>^ bytes)
+		: bound(false), numpixelbytes(0)
 	{
-		auto bytes = File::ReadAllBytes(imgpath);
-
 		this->imgbuffer = gcnew MemoryStream(bytes);
 	}
 };
@@ -91,82 +116,111 @@ public:
 	static opengl_pngtexture * load(tilecache *enclosing, const std::string &path)
 	{
 #ifdef USE_SDL
-		SDL_Surface *raw = IMG_Load(path.c_str());
-		if (!raw) return nullptr;
-
-		int width = raw->w;
-		int height = raw->h;
-
-		SDL_Surface *converted = nullptr;
-
-		GLint mode = GL_RGB;
-		if (raw->format->BytesPerPixel == 4)
-			mode = GL_RGBA;
-		else if (raw->format->BytesPerPixel == 1) {
-			converted = SDL_CreateRGBSurface(0, width, height, 24, 0x0000ff, 0x00ff00, 0xff0000, 0);
-			SDL_BlitSurface(raw, 0, converted, 0);
-		}
-
-		std::unique_ptr<preparation> prepared(new preparation());
-		prepared->rawsurface = raw;
-		prepared->cvtsurface = converted;
-		prepared->mode = mode;
-		prepared->width = width;
-		prepared->height = height;
-		return new opengl_pngtexture(enclosing, prepared.release());
+		return load(enclosing, IMG_Load(path.c_str()));
 #elif defined PLATFORM_IOS
 		GLuint width, height;
 		void *imageData = read_texture(path, &width, &height);
-		if (!imageData) return nullptr;
-    
-		std::auto_ptr<preparation> prepared(new preparation());
-		prepared->rawdata = imageData;
-		prepared->mode = GL_RGBA;
-		prepared->width = width;
-		prepared->height = height;
-		return new opengl_pngtexture(enclosing, prepared.release());
+		return load(enclosing, imageData, width, height);
 #else
 		return nullptr;
 #endif
 	}
 
-	virtual ~opengl_pngtexture()
+	static opengl_pngtexture * load(tilecache *enclosing, const void *data, unsigned int size)
 	{
-		if (this->gltex) {
-#ifdef LOGGING_TEXTURE
-			logger::info("preparing destructing texture", this->gltex);
+#ifdef USE_SDL
+		SDL_RWops *rw = SDL_RWFromConstMem(data, size);
+		if (!rw) return nullptr;
+		return load(enclosing, IMG_Load_RW(rw, 1));
+#elif defined PLATFORM_IOS
+		GLuint width, height;
+		void *imageData = read_texture(data, size, &width, &height);
+		return load(enclosing, imageData, width, height);
+#else
+		return nullptr;
 #endif
-			glDeleteTextures(1, &this->gltex);
-		}
+	}
+
+	virtual ~opengl_pngtexture()
+	{
+		this->unbind();
 	}
 
 	virtual bool is_bound() const
 	{
-		return this->prepared.get() == nullptr;
+		return this->gltex != 0;
 	}
 
 	virtual void bind()
 	{
-		if (!this->prepared.get()) return;
+		if (this->gltex || !this->prepared.get()) return;
 
-		GLuint tex = 0;
-
-		glGenTextures(1, &tex);
-		glBindTexture(GL_TEXTURE_2D, tex);
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 #ifdef USE_SDL
 		SDL_Surface *used = this->prepared->cvtsurface ? this->prepared->cvtsurface : this->prepared->rawsurface;    
-		glTexImage2D(GL_TEXTURE_2D, 0, this->prepared->mode, this->prepared->width, this->prepared->height, 0, this->prepared->mode, GL_UNSIGNED_BYTE, used->pixels);
+		const void *pixels = used->pixels;
 #elif defined PLATFORM_IOS
-		glTexImage2D(GL_TEXTURE_2D, 0, this->prepared->mode, this->prepared->width, this->prepared->height, 0, this->prepared->mode, GL_UNSIGNED_BYTE, this->prepared->rawdata);
+		const void *pixels = this->prepared->rawdata;
 #endif
 
-		this->gltex = tex;
-		this->prepared.reset(nullptr);
+		// tiles go into a slot of the atlas; anything else, like icons, gets a texture of its own
+		auto atlas = this->enclosing ? this->enclosing->get_atlas() : nullptr;
+		if (atlas)
+			this->slot = atlas->allocate(this->prepared->mode, this->prepared->width, this->prepared->height, pixels);
+
+		if (this->slot != -1) {
+			this->gltex = atlas->get_tex(this->slot);
+			atlas->get_texrect(this->slot, this->texrect);
+		}
+		else {
+			GLuint tex = 0;
+
+			glGenTextures(1, &tex);
+			glBindTexture(GL_TEXTURE_2D, tex);
+			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexImage2D(GL_TEXTURE_2D, 0, this->prepared->mode, this->prepared->width, this->prepared->height, 0, this->prepared->mode, GL_UNSIGNED_BYTE, pixels);
+
+			this->gltex = tex;
 #ifdef LOGGING_TEXTURE
 			logger::info("creating texture", this->gltex);
 #endif
+		}
+
+		// tiles keep their pixels, to be bound again after unbind()
+		if (!this->enclosing)
+			this->prepared.reset(nullptr);
+	}
+
+	virtual void unbind()
+	{
+		if (this->slot != -1)
+			this->enclosing->get_atlas()->release(this->slot);
+		else if (this->gltex) {
+#ifdef LOGGING_TEXTURE
+			logger::info("preparing destructing texture", this->gltex);
+#endif
+			glDeleteTextures(1, &this->gltex);
+		}
+
+		this->gltex = 0;
+		this->slot = -1;
+		this->texrect[0] = this->texrect[1] = 0.0f;
+		this->texrect[2] = this->texrect[3] = 1.0f;
+	}
+
+	virtual unsigned int get_numbytes() const
+	{
+		return this->gltex ? 0 : this->numresidentbytes;
+	}
+
+	virtual unsigned int get_numresidentbytes() const
+	{
+		return this->prepared.get() ? this->numresidentbytes : 0;
+	}
+
+	virtual unsigned int get_numboundbytes() const
+	{
+		return this->gltex ? this->numresidentbytes : 0;
 	}
 
 	virtual GLuint get_tex() const
@@ -174,6 +228,11 @@ public:
 		return this->gltex;
 	}
 
+	virtual const GLfloat * get_texrect() const
+	{
+		return this->texrect;
+	}
+
 private:
 	struct preparation
 	{
@@ -201,191 +260,886 @@ private:
 	tilecache *enclosing;
 	std::unique_ptr<preparation> prepared;
 	GLuint gltex;
+	int slot;
+	GLfloat texrect[4];
+	// the pixels take the same size, in memory or in the graphics system
+	unsigned int numresidentbytes;
 
 	opengl_pngtexture(tilecache *enclosing, preparation *prepared)
-		: enclosing(enclosing), prepared(prepared), gltex(0)
+		: enclosing(enclosing), prepared(prepared), gltex(0), slot(-1), numresidentbytes(prepared->width * prepared->height * (prepared->mode == GL_RGBA ? 4 : 3))
 	{
+		this->texrect[0] = this->texrect[1] = 0.0f;
+		this->texrect[2] = this->texrect[3] = 1.0f;
 	}
 
-	opengl_pngtexture(const pngtexture &r);
-	opengl_pngtexture & operator=(const pngtexture &r);
-};
-#endif
+#ifdef USE_SDL
+	static opengl_pngtexture * load(tilecache *enclosing, SDL_Surface *raw)
+	{
+		if (!raw) return nullptr;
 
-pngtexture * pngtexture::load(tilecache *enclosing, const std::string &path)
-{
-#ifdef PLATFORM_CLR
-	try {
-		return wpf_pngtexture::load(enclosing, path);
+		int width = raw->w;
+		int height = raw->h;
+
+		SDL_Surface *converted = nullptr;
+
+		GLint mode = GL_RGB;
+		if (raw->format->BytesPerPixel == 4)
+			mode = GL_RGBA;
+		else if (raw->format->BytesPerPixel == 1) {
+			converted = SDL_CreateRGBSurface(0, width, height, 24, 0x0000ff, 0x00ff00, 0xff0000, 0);
+			SDL_BlitSurface(raw, 0, converted, 0);
+			// the pixels are kept after bind(), so only the converted ones stay
+			SDL_FreeSurface(raw);
+			raw = nullptr;
+		}
+
+		std::unique_ptr<preparation> prepared(new preparation());
+		prepared->rawsurface = raw;
+		prepared->cvtsurface = converted;
+		prepared->mode = mode;
+		prepared->width = width;
+		prepared->height = height;
+		return new opengl_pngtexture(enclosing, prepared.release());
 	}
-	catch (IOException^) {
-		return nullptr;
+#elif defined PLATFORM_IOS
+	static opengl_pngtexture * load(tilecache *enclosing, void *imageData, GLuint width, GLuint height)
+	{
+		if (!imageData) return nullptr;
+
+		std::auto_ptr<preparation> prepared(new preparation());
+		prepared->rawdata = imageData;
+		prepared->mode = GL_RGBA;
+		prepared->width = width;
+		prepared->height = height;
+		return new opengl_pngtexture(enclosing, prepared.release());
 	}
-#else
-	return opengl_pngtexture::load(enclosing, path);
 #endif
-}
 
-#ifdef PLATFORM_CLR
-class wpf_renderer : public renderer
+	opengl_pngtexture(const pngtexture &r);
+	opengl_pngtexture & operator=(const pngtexture &r);
+};
+
+class opengl_tileatlas : public tileatlas
 {
 public:
-	wpf_renderer(short tilesize)
-		: drawctxvalid(false)
+	opengl_tileatlas(short tilesize, unsigned int numslotskept)
+		: tilesize(tilesize), numslotskept(numslotskept), pagesize(0), slotsperrow(0), numreused(0), numcreated(0)
 	{
 	}
 
-	virtual void set_context(render_context &ctx)
+	virtual ~opengl_tileatlas()
 	{
-		this->drawctxvalid = ctx.valid;
-		this->drawctx = ctx.drawctx;
+		for (auto i = this->pages.begin(); i != this->pages.end(); ++i) {
+			if (i->gltex)
+				glDeleteTextures(1, &i->gltex);
+		}
 	}
 
-	virtual void draw_tile(int timestamp, tilecache *tiles, const mapctrl::screenpair &screensize, const mapctrl::tilelayer &layer, const float *factor, bool draw, const mapctrl::tilepair &tile, const mapctrl::pixelpair &pixel)
+	virtual int allocate(GLint mode, int width, int height, const void *pixels)
 	{
-		if (!this->drawctxvalid) return;
-
-		auto pos = layer.get_screen(tile);
-		{
-			auto mapsize = static_cast<int>(layer.get_mapsize());
-
-			int rotatecount = 0;
-			if (pixel.x < 0)
-				rotatecount = (-pixel.x + mapsize - 1) / mapsize;
-			else if (pixel.x >= mapsize)
-				rotatecount = -pixel.x / mapsize;
-
-			if (rotatecount) {
-				auto safetile = tile;
-				safetile.x -= rotatecount * layer.get_tilenum();
-				pos = layer.get_screen(safetile);
-			}
-		}
+		if (width != this->tilesize || height != this->tilesize) return -1;
 
-		auto key = layer.get_quadkey(tile);
-
-		TransformGroup^ transform = gcnew TransformGroup();
-		transform->Children->Add(gcnew TranslateTransform(static_cast<float>(pos.x), static_cast<float>(pos.y)));
-		if (factor) {
-			transform->Children->Add(gcnew TranslateTransform(-static_cast<float>(screensize.x) / 2, -static_cast<float>(screensize.y) / 2));
-			transform->Children->Add(gcnew ScaleTransform(*factor, *factor));
-			transform->Children->Add(gcnew TranslateTransform(static_cast<float>(screensize.x) / 2, static_cast<float>(screensize.y) / 2));
+		// pages only ever hold one pixel format, as glTexSubImage2D cannot convert
+		int index = 0;
+		for ( ; index < static_cast<int>(this->pages.size()); ++index) {
+			if (this->pages[index].gltex && this->pages[index].mode == mode && !this->pages[index].freeslots.empty())
+				break;
 		}
+		if (index == static_cast<int>(this->pages.size()))
+			index = this->add_page(mode);
+		else
+			this->numreused++;
+		if (index == -1)
+			return -1;
 
-		bool found = false;
-		int texzoomlevel = 1;
-		auto image = this->get_texture(key, timestamp, tiles, &found, &texzoomlevel);
-		if (draw && found) {
-			this->drawctx->PushTransform(transform);
-
-			int difflevel = layer.get_zoomlevel() - texzoomlevel;
-			if (difflevel == 0) {
-				Size size(layer.get_tilesize(), layer.get_tilesize());
-				Rect rect(size);
-				this->drawctx->DrawImage(image, rect);
-			}
-			else {
-				auto targetpix = layer.get_pixel(tile);
-				float scale = std::pow(2.f, difflevel);
-				auto sourcepix = mapctrl::pixelpair(static_cast<int>(targetpix.x / scale), static_cast<int>(targetpix.y / scale));
-				auto sourcealignedpix = layer.get_pixel(layer.get_tile(sourcepix));
-
-				double w = layer.get_tilesize() * scale;
-				double x = (sourcepix.x - sourcealignedpix.x) * scale;
-				double y = (sourcepix.y - sourcealignedpix.y) * scale;
-				Size size(w, w);
-				Point start(-x, -y);
-				Rect rect(start, size);
+		auto &target = this->pages[index];
+		int slot = target.freeslots.back();
+		target.freeslots.pop_back();
 
-				auto cliprect = gcnew RectangleGeometry(Rect(Size(layer.get_tilesize(), layer.get_tilesize())));
-				this->drawctx->PushClip(cliprect);
+		glBindTexture(GL_TEXTURE_2D, target.gltex);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % this->slotsperrow) * this->tilesize, (slot / this->slotsperrow) * this->tilesize, width, height, mode, GL_UNSIGNED_BYTE, pixels);
 
-				this->drawctx->DrawImage(image, rect);
+		return index * this->get_slotsperpage() + slot;
+	}
 
-				this->drawctx->Pop();
-			}
+	virtual void release(int slot)
+	{
+		auto &target = this->pages[slot / this->get_slotsperpage()];
+		target.freeslots.push_back(slot % this->get_slotsperpage());
 
-			this->drawctx->Pop();
+		// a page that went empty is only given back to GL if the others are enough to hold the cache
+		if (static_cast<int>(target.freeslots.size()) == this->get_slotsperpage() && (this->get_numpages() - 1) * this->get_slotsperpage() >= this->numslotskept) {
+#ifdef LOGGING_TEXTURE
+			logger::info("destructing atlas page", target.gltex, this->get_numpages() - 1);
+#endif
+			glDeleteTextures(1, &target.gltex);
+			target.gltex = 0;
+			target.freeslots.clear();
 		}
 	}
 
-private:
-	bool drawctxvalid;
-	gcroot<DrawingContext^> drawctx;
+	virtual GLuint get_tex(int slot) const
+	{
+		return this->pages[slot / this->get_slotsperpage()].gltex;
+	}
 
-	ImageSource^ get_texture(const mapctrl::quadkey &key, int timestamp, tilecache *tiles, bool *found, int *zoomlevel)
+	virtual void get_texrect(int slot, GLfloat *rect) const
 	{
-		auto result = tiles->get_texture(key, timestamp);
-		if (!result.second) {
-			*found = false;
-			*zoomlevel = 0;
-			return nullptr;
-		}
+		// half a texel is left out on every side so that filtering never
+		// reaches into the neighboring slots
+		int local = slot % this->get_slotsperpage();
+		GLfloat size = static_cast<GLfloat>(this->pagesize);
+		rect[0] = ((local % this->slotsperrow) * this->tilesize + 0.5f) / size;
+		rect[1] = ((local / this->slotsperrow) * this->tilesize + 0.5f) / size;
+		rect[2] = rect[3] = (this->tilesize - 1.0f) / size;
+	}
 
-		*found = true;
-		*zoomlevel = result.first.get_lod();
-		return result.second->get_tex();
+	virtual std::pair<unsigned int, unsigned int> get_numallocations() const
+	{
+		return std::make_pair(this->numreused, this->numcreated);
 	}
-};
-#elif defined USE_OPENGL
-class opengl_renderer : public renderer
-{
-public:
-	opengl_renderer(short tilesize)
-		: tilevertices(nullptr)
+
+private:
+	struct page
 	{
-		static const char vertices[] =
-		{
-			0, 0,
-			1, 0,
-			1, 1,
-			0, 1,
-			// the followings are for lines
-			1, 0,
-			1, 1,
-			0, 0,
-			0, 1,
-		};
-		int numvert = sizeof(vertices) / sizeof(char);
+		// 0 once the page has been given back to GL
+		GLuint gltex;
+		GLint mode;
+		std::vector<int> freeslots;
+	};
 
-		this->tilevertices = new GLshort[numvert];
-		for (int i = 0; i < numvert; ++i)
-			this->tilevertices[i] = vertices[i] * tilesize;
+	static const GLint MAXPAGESIZE = 2048;
+
+	const short tilesize;
+	const unsigned int numslotskept;
+	GLint pagesize;
+	int slotsperrow;
+	std::vector<page> pages;
+	unsigned int numreused;
+	unsigned int numcreated;
+
+	int get_slotsperpage() const
+	{
+		return this->slotsperrow * this->slotsperrow;
 	}
 
-	~opengl_renderer()
+	unsigned int get_numpages() const
 	{
-		if (this->tilevertices)
-			delete [] this->tilevertices;
+		unsigned int count = 0;
+		for (auto i = this->pages.begin(); i != this->pages.end(); ++i) {
+			if (i->gltex) count++;
+		}
+		return count;
 	}
 
-	virtual void draw_tile(int timestamp, tilecache *tiles, const mapctrl::screenpair &screensize, const mapctrl::tilelayer &layer, const float *factor, bool draw, const mapctrl::tilepair &tile, const mapctrl::pixelpair &pixel)
+	int add_page(GLint mode)
 	{
-		auto pos = layer.get_screen(tile);
-		{
-			auto mapsize = static_cast<int>(layer.get_mapsize());
-
-			int rotatecount = 0;
-			if (pixel.x < 0)
-				rotatecount = (-pixel.x + mapsize - 1) / mapsize;
-			else if (pixel.x >= mapsize)
-				rotatecount = -pixel.x / mapsize;
-
-			if (rotatecount) {
-				auto safetile = tile;
-				safetile.x -= rotatecount * layer.get_tilenum();
-				pos = layer.get_screen(safetile);
-			}
+		if (!this->pagesize) {
+			GLint maxsize = 0;
+			glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxsize);
+			this->pagesize = std::min<GLint>(std::max<GLint>(maxsize, this->tilesize), MAXPAGESIZE);
+			this->slotsperrow = this->pagesize / this->tilesize;
 		}
 
+		// the place of a page given back is taken first, so that slot numbers stay small
+		int index = 0;
+		for ( ; index < static_cast<int>(this->pages.size()); ++index) {
+			if (!this->pages[index].gltex) break;
+		}
+		if (index == static_cast<int>(this->pages.size()))
+			this->pages.push_back(page());
+
+		auto &adding = this->pages[index];
+		adding.gltex = 0;
+		adding.mode = mode;
+
+		glGenTextures(1, &adding.gltex);
+		if (!adding.gltex) return -1;
+
+		glBindTexture(GL_TEXTURE_2D, adding.gltex);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, mode, this->pagesize, this->pagesize, 0, mode, GL_UNSIGNED_BYTE, nullptr);
+
+		for (int i = this->get_slotsperpage() - 1; i >= 0; --i)
+			adding.freeslots.push_back(i);
+		this->numcreated++;
+
+#ifdef LOGGING_TEXTURE
+		logger::info("creating atlas page", adding.gltex, this->pagesize, this->get_numpages());
+#endif
+		return index;
+	}
+
+	opengl_tileatlas(const opengl_tileatlas &r);
+	opengl_tileatlas & operator=(const opengl_tileatlas &r);
+};
+
+tileatlas * tileatlas::create(short tilesize, unsigned int numslotskept)
+{
+	return new opengl_tileatlas(tilesize, numslotskept);
+}
+#else
+// keeps the decoded pixels in memory, where software_renderer reads them
+class software_pngtexture : public pngtexture
+{
+public:
+	static software_pngtexture * load(tilecache *enclosing, const std::string &path)
+	{
+		return load(IMG_Load(path.c_str()));
+	}
+
+	static software_pngtexture * load(tilecache *enclosing, const void *data, unsigned int size)
+	{
+		SDL_RWops *rw = SDL_RWFromConstMem(data, size);
+		if (!rw) return nullptr;
+		return load(IMG_Load_RW(rw, 1));
+	}
+
+	virtual bool is_bound() const
+	{
+		return true;
+	}
+
+	virtual void bind()
+	{
+	}
+
+	virtual void unbind()
+	{
+	}
+
+	virtual unsigned int get_numbytes() const
+	{
+		return 0;
+	}
+
+	virtual unsigned int get_numresidentbytes() const
+	{
+		return static_cast<unsigned int>(this->pixels.size());
+	}
+
+	virtual unsigned int get_numboundbytes() const
+	{
+		return 0;
+	}
+
+	virtual const unsigned char * get_pixels() const
+	{
+		return &this->pixels[0];
+	}
+
+	virtual int get_width() const
+	{
+		return this->width;
+	}
+
+	virtual int get_height() const
+	{
+		return this->height;
+	}
+
+private:
+	std::vector<unsigned char> pixels;
+	int width;
+	int height;
+
+	software_pngtexture(int width, int height)
+		: pixels(width * height * 4), width(width), height(height)
+	{
+	}
+
+	static Uint32 get_rawpixel(const Uint8 *p, int bytesperpixel)
+	{
+		switch (bytesperpixel) {
+		case 1:
+			return *p;
+		case 2:
+			return *reinterpret_cast<const Uint16 *>(p);
+		case 3:
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+			return p[0] << 16 | p[1] << 8 | p[2];
+#else
+			return p[0] | p[1] << 8 | p[2] << 16;
+#endif
+		default:
+			return *reinterpret_cast<const Uint32 *>(p);
+		}
+	}
+
+	static software_pngtexture * load(SDL_Surface *raw)
+	{
+		if (!raw) return nullptr;
+		if (raw->w <= 0 || raw->h <= 0) {
+			SDL_FreeSurface(raw);
+			return nullptr;
+		}
+
+		std::unique_ptr<software_pngtexture> texture(new software_pngtexture(raw->w, raw->h));
+
+		// whatever the decoder gave, palettes included, ends up as RGBA
+		SDL_LockSurface(raw);
+		int bytesperpixel = raw->format->BytesPerPixel;
+		for (int y = 0; y < raw->h; ++y) {
+			auto src = static_cast<const Uint8 *>(raw->pixels) + y * raw->pitch;
+			auto dst = &texture->pixels[y * raw->w * 4];
+			for (int x = 0; x < raw->w; ++x, src += bytesperpixel, dst += 4)
+				SDL_GetRGBA(get_rawpixel(src, bytesperpixel), raw->format, &dst[0], &dst[1], &dst[2], &dst[3]);
+		}
+		SDL_UnlockSurface(raw);
+		SDL_FreeSurface(raw);
+
+		return texture.release();
+	}
+
+	software_pngtexture(const pngtexture &r);
+	software_pngtexture & operator=(const pngtexture &r);
+};
+#endif
+
+pngtexture * pngtexture::load(tilecache *enclosing, const std::string &path)
+{
+#ifdef PLATFORM_CLR
+	try {
+		return wpf_pngtexture::load(enclosing, path);
+	}
+	catch (IOException^) {
+		return nullptr;
+	}
+#elif defined USE_OPENGL
+	return opengl_pngtexture::load(enclosing, path);
+#else
+	return software_pngtexture::load(enclosing, path);
+#endif
+}
+
+pngtexture * pngtexture::load(tilecache *enclosing, const void *data, unsigned int size)
+{
+#ifdef PLATFORM_CLR
+	return wpf_pngtexture::load(enclosing, data, size);
+#elif defined USE_OPENGL
+	return opengl_pngtexture::load(enclosing, data, size);
+#else
+	return software_pngtexture::load(enclosing, data, size);
+#endif
+}
+
+// the screen position of a tile, taking into account that the map wraps around horizontally
+static mapctrl::screenpair get_tilescreen(const mapctrl::tilelayer &layer, const mapctrl::tilepair &tile, const mapctrl::pixelpair &pixel)
+{
+	auto pos = layer.get_screen(tile);
+	{
+		auto mapsize = static_cast<int>(layer.get_mapsize());
+
+		int rotatecount = 0;
+		if (pixel.x < 0)
+			rotatecount = (-pixel.x + mapsize - 1) / mapsize;
+		else if (pixel.x >= mapsize)
+			rotatecount = -pixel.x / mapsize;
+
+		if (rotatecount) {
+			auto safetile = tile;
+			safetile.x -= rotatecount * layer.get_tilenum();
+			pos = layer.get_screen(safetile);
+		}
+	}
+	return pos;
+}
+
+void renderer::draw_layer(int timestamp, tilecache *tiles, const mapctrl::screenpair &screensize, const mapctrl::tilelayer &layer, const float *factor, bool draw, const std::set<mapctrl::quadkey> *hidden)
+{
+	for (auto i = layer.visible(); i.movenext(); ) {
+		if (hidden && hidden->count(layer.get_quadkey(i.currenttile()))) continue;
+		this->draw_tile(timestamp, tiles, screensize, layer, factor, draw, i.currenttile(), i.currentpixel());
+	}
+}
+
+// the visible tiles of a layer but the hidden ones, and what the cache has to
+// draw each of them with, looked up all at once
+struct visibleset
+{
+	std::vector<mapctrl::tilepair> tiles;
+	std::vector<mapctrl::pixelpair> pixels;
+	std::vector<mapctrl::quadkey> keys;
+	std::vector<std::pair<mapctrl::quadkey, const pngtexture *>> found;
+
+	void find(int timestamp, tilecache *cache, const mapctrl::tilelayer &layer, const std::set<mapctrl::quadkey> *hidden)
+	{
+		this->tiles.clear();
+		this->pixels.clear();
+		this->keys.clear();
+
+		for (auto i = layer.visible(); i.movenext(); ) {
+			auto key = layer.get_quadkey(i.currenttile());
+			if (hidden && hidden->count(key)) continue;
+
+			this->tiles.push_back(i.currenttile());
+			this->pixels.push_back(i.currentpixel());
+			this->keys.push_back(key);
+		}
+
+		cache->get_textures(this->keys, timestamp, this->found);
+	}
+
+	size_t size() const
+	{
+		return this->keys.size();
+	}
+};
+
+#ifdef PLATFORM_CLR
+class wpf_renderer : public renderer
+{
+public:
+	wpf_renderer(short tilesize)
+		: drawctxvalid(false)
+	{
+	}
+
+	virtual void set_context(render_context &ctx)
+	{
+		this->drawctxvalid = ctx.valid;
+		this->drawctx = ctx.drawctx;
+	}
+
+	virtual void draw_tile(int timestamp, tilecache *tiles, const mapctrl::screenpair &screensize, const mapctrl::tilelayer &layer, const float *factor, bool draw, const mapctrl::tilepair &tile, const mapctrl::pixelpair &pixel)
+	{
+		if (!this->drawctxvalid) return;
+
+		auto pos = get_tilescreen(layer, tile, pixel);
+
+		auto key = layer.get_quadkey(tile);
+
+		TransformGroup^ transform = gcnew TransformGroup();
+		transform->Children->Add(gcnew TranslateTransform(static_cast<float>(pos.x), static_cast<float>(pos.y)));
+		if (factor) {
+			transform->Children->Add(gcnew TranslateTransform(-static_cast<float>(screensize.x) / 2, -static_cast<float>(screensize.y) / 2));
+			transform->Children->Add(gcnew ScaleTransform(*factor, *factor));
+			transform->Children->Add(gcnew TranslateTransform(static_cast<float>(screensize.x) / 2, static_cast<float>(screensize.y) / 2));
+		}
+
+		bool found = false;
+		int texzoomlevel = 1;
+		auto image = this->get_texture(key, timestamp, tiles, &found, &texzoomlevel);
+		if (draw && found) {
+			this->drawctx->PushTransform(transform);
+
+			int difflevel = layer.get_zoomlevel() - texzoomlevel;
+			if (difflevel == 0) {
+				Size size(layer.get_tilesize(), layer.get_tilesize());
+				Rect rect(size);
+				this->drawctx->DrawImage(image, rect);
+			}
+			else {
+				auto targetpix = layer.get_pixel(tile);
+				float scale = std::pow(2.f, difflevel);
+				auto sourcepix = mapctrl::pixelpair(static_cast<int>(targetpix.x / scale), static_cast<int>(targetpix.y / scale));
+				auto sourcealignedpix = layer.get_pixel(layer.get_tile(sourcepix));
+
+				double w = layer.get_tilesize() * scale;
+				double x = (sourcepix.x - sourcealignedpix.x) * scale;
+				double y = (sourcepix.y - sourcealignedpix.y) * scale;
+				Size size(w, w);
+				Point start(-x, -y);
+				Rect rect(start, size);
+
+				auto cliprect = gcnew RectangleGeometry(Rect(Size(layer.get_tilesize(), layer.get_tilesize())));
+				this->drawctx->PushClip(cliprect);
+
+				this->drawctx->DrawImage(image, rect);
+
+				this->drawctx->Pop();
+			}
+
+			this->drawctx->Pop();
+		}
+	}
+
+private:
+	bool drawctxvalid;
+	gcroot<DrawingContext^> drawctx;
+
+	ImageSource^ get_texture(const mapctrl::quadkey &key, int timestamp, tilecache *tiles, bool *found, int *zoomlevel)
+	{
+		auto result = tiles->get_texture(key, timestamp);
+		if (!result.second) {
+			*found = false;
+			*zoomlevel = 0;
+			return nullptr;
+		}
+
+		*found = true;
+		*zoomlevel = result.first.get_lod();
+		return result.second->get_tex();
+	}
+};
+#elif defined USE_OPENGL
+// the part of the texture to draw the tile with, when the texture is texlod's ancestor of it
+static void get_tiletexcoords(const mapctrl::tilelayer &layer, const mapctrl::tilepair &tile, int texlod, const GLfloat *texrect, GLfloat *x, GLfloat *y, GLfloat *w, GLfloat *h)
+{
+	*x = *y = 0.0f;
+	*w = *h = 1.0f;
+
+	int difflevel = layer.get_zoomlevel() - texlod;
+	if (difflevel != 0) {
+		auto targetpix = layer.get_pixel(tile);
+		float scale = std::pow(2.f, difflevel);
+		auto sourcepix = mapctrl::pixelpair(static_cast<int>(targetpix.x / scale), static_cast<int>(targetpix.y / scale));
+		auto sourcealignedpix = layer.get_pixel(layer.get_tile(sourcepix));
+
+		*w = *h = layer.get_tilesize() / scale / layer.get_tilesize();
+		*x = (sourcepix.x - sourcealignedpix.x) / static_cast<float>(layer.get_tilesize());
+		*y = (sourcepix.y - sourcealignedpix.y) / static_cast<float>(layer.get_tilesize());
+	}
+
+	// from the tile to its place in the texture
+	*x = texrect[0] + *x * texrect[2];
+	*y = texrect[1] + *y * texrect[3];
+	*w *= texrect[2];
+	*h *= texrect[3];
+}
+
+// the fixed-function pipeline is not there in an OpenGL ES 2 context
+#ifndef USE_GLES2
+namespace config
+{
+	static bool showwireframe = false;
+}
+
+static std::pair<bool, int> get_tiletexture(const mapctrl::quadkey &key, int timestamp, tilecache *tiles, GLuint *texture, const GLfloat **texrect)
+{
+	auto result = tiles->get_texture(key, timestamp);
+	if (!result.second)
+		return std::make_pair(false, 0);
+	*texture = result.second->get_tex();
+	*texrect = result.second->get_texrect();
+	return std::make_pair(true, result.first.get_lod());
+}
+
+class opengl_renderer : public renderer
+{
+public:
+	opengl_renderer(short tilesize)
+		: tilevertices(nullptr)
+	{
+		static const char vertices[] =
+		{
+			0, 0,
+			1, 0,
+			1, 1,
+			0, 1,
+			// the followings are for lines
+			1, 0,
+			1, 1,
+			0, 0,
+			0, 1,
+		};
+		int numvert = sizeof(vertices) / sizeof(char);
+
+		this->tilevertices = new GLshort[numvert];
+		for (int i = 0; i < numvert; ++i)
+			this->tilevertices[i] = vertices[i] * tilesize;
+	}
+
+	~opengl_renderer()
+	{
+		if (this->tilevertices)
+			delete [] this->tilevertices;
+#ifdef GL_OES_framebuffer_object
+		this->release_scroll();
+#endif
+	}
+
+	virtual void draw_tile(int timestamp, tilecache *tiles, const mapctrl::screenpair &screensize, const mapctrl::tilelayer &layer, const float *factor, bool draw, const mapctrl::tilepair &tile, const mapctrl::pixelpair &pixel)
+	{
+		auto pos = get_tilescreen(layer, tile, pixel);
+
 		auto key = layer.get_quadkey(tile);
 #ifdef LOGGING_VISIBLETILES
 		{
 			logger::info(key.str(), tile.x, tile.y);
 			logger::info(" -> ", pos.x, pos.y);
 		}
-#endif
+#endif
+
+		glPushMatrix();
+
+		glLoadIdentity();
+		if (factor) {
+			glTranslatef(static_cast<float>(screensize.x) / 2, static_cast<float>(screensize.y) / 2, 0.0);
+			glScalef(*factor, *factor, 0.0);
+			glTranslatef(-static_cast<float>(screensize.x) / 2, -static_cast<float>(screensize.y) / 2, 0.0);
+		}
+		glTranslatef(static_cast<float>(pos.x), static_cast<float>(pos.y), 0.0);
+
+		if (config::showwireframe) {
+			static const float colors[][3] =
+			{
+				{ 1.0f, 0.0f, 0.0f, },
+				{ 1.0f, 1.0f, 0.0f, },
+				{ 0.0f, 1.0f, 0.0f, },
+				{ 0.0f, 0.0f, 1.0f, },
+			};
+			const float *color = colors[layer.get_zoomlevel() % 4];
+			glColor4f(color[0], color[1], color[2], 1.0f);
+
+			glEnableClientState(GL_VERTEX_ARRAY);
+			glVertexPointer(2, GL_SHORT, 0, this->tilevertices);
+			glDrawArrays(GL_LINES, 0, 8);
+			glDisableClientState(GL_VERTEX_ARRAY);
+
+			if (false) {
+				static const short markvertices[] =
+				{
+					0, 0,
+					5, 0,
+					5, 5,
+					0, 5,
+				};
+				for (int i = 0; i < key.get_lod(); ++i) {
+					auto bit2 = key[i];
+					const float *markcolor = colors[bit2];
+					glColor4f(markcolor[0], markcolor[1], markcolor[2], 1.0f);
+
+					glPushMatrix();
+
+					glLoadIdentity();
+					glTranslatef(static_cast<float>(i) * 6.0f + 2.0f, 2.0f, 0.0f);
+					if (factor)
+						glScalef(*factor, *factor, 0.0f);
+					glTranslatef(static_cast<float>(pos.x), static_cast<float>(pos.y), 0.0f);
+
+					glEnableClientState(GL_VERTEX_ARRAY);
+					glVertexPointer(2, GL_SHORT, 0, markvertices);
+					glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+					glDisableClientState(GL_VERTEX_ARRAY);
+
+					glPopMatrix();
+				}
+			}
+		}
+		else {
+			GLuint texture = 0;
+			const GLfloat *texrect = nullptr;
+			auto result = get_tiletexture(key, timestamp, tiles, &texture, &texrect);
+			if (draw && result.first) {
+				glBindTexture(GL_TEXTURE_2D, texture);
+				glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+
+				glEnableClientState(GL_VERTEX_ARRAY);
+				glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+				glVertexPointer(2, GL_SHORT, 0, this->tilevertices);
+
+				GLfloat x, y, w, h;
+				get_tiletexcoords(layer, tile, result.second, texrect, &x, &y, &w, &h);
+				GLfloat texvertices[] = { x, y, x + w, y, x + w, y + h, x, y + h };
+				glTexCoordPointer(2, GL_FLOAT, 0, texvertices);
+
+				glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+				glDisableClientState(GL_VERTEX_ARRAY);
+				glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+			}
+		}
+
+		glPopMatrix();
+	}
+
+	virtual void draw_layer(int timestamp, tilecache *tiles, const mapctrl::screenpair &screensize, const mapctrl::tilelayer &layer, const float *factor, bool draw, const std::set<mapctrl::quadkey> *hidden)
+	{
+		if (config::showwireframe) {
+			renderer::draw_layer(timestamp, tiles, screensize, layer, factor, draw, hidden);
+			return;
+		}
+
+#ifdef GL_OES_framebuffer_object
+		if (!factor && !hidden && draw && this->scroll.enabled && this->prepare_scroll(screensize)) {
+			this->draw_scrolled(timestamp, tiles, screensize, layer);
+			return;
+		}
+		this->scroll.valid = false;
+#endif
+
+		this->collect_batches(timestamp, tiles, layer, draw, hidden, nullptr);
+		this->submit_batches(screensize, factor);
+	}
+
+	virtual void set_scrolling(bool scrolling)
+	{
+		this->scroll.enabled = scrolling;
+	}
+
+	virtual void invalidate()
+	{
+		this->scroll.valid = false;
+	}
+
+#ifdef IMPLEMENT_GPSPIN
+	virtual void draw_gpspin(const mapctrl::screenpair &screen, const pngtexture *texture, const mapctrl::screenpair &hotpoint)
+	{
+		if (!texture) return;
+
+		static const GLshort texvertices[] = { 0, 0, 1, 0, 1, 1, 0, 1 };
+		static const GLshort vertices[] = { 0, 0, 16, 0, 16, 16, 0, 16 };
+
+		glPushMatrix();
+		glLoadIdentity();
+		glTranslatef(static_cast<float>(screen.x - hotpoint.x), static_cast<float>(screen.y - hotpoint.y), 0.0f);
+
+		glBindTexture(GL_TEXTURE_2D, texture->get_tex());
+		glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glVertexPointer(2, GL_SHORT, 0, vertices);
+		glTexCoordPointer(2, GL_SHORT, 0, texvertices);
+		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+		glDisableClientState(GL_VERTEX_ARRAY);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+
+		glPopMatrix();
+	}
+
+	virtual void draw_gpspin_shadow(const mapctrl::screenpair &screen, float radius)
+	{
+		const int nummaxsegs = 50;
+		GLfloat vertices[nummaxsegs * 2];
+		int numsegs = nummaxsegs;
+		for (int i = 0; i < numsegs; ++i) {
+			float theta = 2.0f * static_cast<float>(M_PI) * static_cast<float>(i) / static_cast<float>(numsegs);
+			vertices[i * 2 + 0] = radius * std::cos(theta);
+			vertices[i * 2 + 1] = radius * std::sin(theta);
+		}
+
+		glPushMatrix();
+		glLoadIdentity();
+		glTranslatef(static_cast<float>(screen.x), static_cast<float>(screen.y), 0.0f);
+
+		glColor4f(0.2f, 0.2f, 0.4f, 0.3f);
+
+		glEnable(GL_LINE_SMOOTH);
+		glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
+
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glVertexPointer(2, GL_FLOAT, 0, vertices);
+		glDrawArrays(GL_TRIANGLE_FAN, 0, numsegs);
+		glDisableClientState(GL_VERTEX_ARRAY);
+
+		glDisable(GL_LINE_SMOOTH);
+
+		glPopMatrix();
+	}
+#endif
+
+private:
+#ifdef GL_OES_framebuffer_object
+	typedef void (GL_APIENTRYP genframebuffersproc)(GLsizei n, GLuint *framebuffers);
+	typedef void (GL_APIENTRYP deleteframebuffersproc)(GLsizei n, const GLuint *framebuffers);
+	typedef void (GL_APIENTRYP bindframebufferproc)(GLenum target, GLuint framebuffer);
+	typedef void (GL_APIENTRYP framebuffertexture2dproc)(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+	typedef GLenum (GL_APIENTRYP checkframebufferstatusproc)(GLenum target);
+#endif
+
+	// the tiles of a layer that sample from the same texture
+	struct batch
+	{
+		std::vector<GLshort> vertices;
+		std::vector<GLfloat> texcoords;
+	};
+
+	// the base layer as the last frame drew it, in one of two offscreen
+	// textures, so that panning only has to draw the strips it uncovers
+	struct scrollcache
+	{
+		scrollcache()
+			: enabled(false), supported(-1), valid(false), front(0), size(0, 0), texsize(0, 0), zoomlevel(0), pixelnw(0, 0)
+#ifdef GL_OES_framebuffer_object
+			, genframebuffers(nullptr), deleteframebuffers(nullptr), bindframebuffer(nullptr), framebuffertexture2d(nullptr), checkframebufferstatus(nullptr)
+#endif
+		{
+			this->gltex[0] = this->gltex[1] = 0;
+			this->fbo[0] = this->fbo[1] = 0;
+		}
+
+		bool enabled;
+		// whether the framebuffer extension is there, with its entry points loaded; -1 until checked
+		int supported;
+		bool valid;
+		int front;
+		GLuint gltex[2];
+		GLuint fbo[2];
+		mapctrl::screenpair size;
+		mapctrl::screenpair texsize;
+		int zoomlevel;
+		mapctrl::pixelpair pixelnw;
+#ifdef GL_OES_framebuffer_object
+		genframebuffersproc genframebuffers;
+		deleteframebuffersproc deleteframebuffers;
+		bindframebufferproc bindframebuffer;
+		framebuffertexture2dproc framebuffertexture2d;
+		checkframebufferstatusproc checkframebufferstatus;
+#endif
+	};
+
+	GLshort *tilevertices;
+	std::map<GLuint, batch> batches;
+	scrollcache scroll;
+	visibleset visible;
+
+	// when kept is given, tiles that lie entirely inside it are asked for but not drawn
+	void collect_batches(int timestamp, tilecache *tiles, const mapctrl::tilelayer &layer, bool draw, const std::set<mapctrl::quadkey> *hidden, const std::pair<mapctrl::screenpair, mapctrl::screenpair> *kept)
+	{
+		// batches left unused by the previous layer belong to textures that may be gone
+		for (auto i = this->batches.begin(); i != this->batches.end(); ) {
+			if (i->second.vertices.empty())
+				this->batches.erase(i++);
+			else {
+				i->second.vertices.clear();
+				i->second.texcoords.clear();
+				++i;
+			}
+		}
+
+		// two triangles per tile, as GL ES has no quads
+		static const int corners[] = { 0, 1, 2, 0, 2, 3 };
+		int tilesize = static_cast<int>(layer.get_tilesize());
+
+		this->visible.find(timestamp, tiles, layer, hidden);
+		for (size_t i = 0; i < this->visible.size(); ++i) {
+			auto &tile = this->visible.tiles[i];
+			auto pos = get_tilescreen(layer, tile, this->visible.pixels[i]);
+#ifdef LOGGING_VISIBLETILES
+			logger::info(this->visible.keys[i].str(), tile.x, tile.y);
+			logger::info(" -> ", pos.x, pos.y);
+#endif
+			auto &found = this->visible.found[i];
+			if (!draw || !found.second) continue;
+			GLuint texture = found.second->get_tex();
+			const GLfloat *texrect = found.second->get_texrect();
+
+			if (kept) {
+				if (pos.x >= kept->first.x && pos.y >= kept->first.y && pos.x + tilesize <= kept->second.x && pos.y + tilesize <= kept->second.y)
+					continue;
+			}
+
+			GLfloat x, y, w, h;
+			get_tiletexcoords(layer, tile, found.first.get_lod(), texrect, &x, &y, &w, &h);
+			const GLfloat texvertices[] = { x, y, x + w, y, x + w, y + h, x, y + h };
+
+			auto &target = this->batches[texture];
+			for (int j = 0; j < 6; ++j) {
+				int corner = corners[j];
+				target.vertices.push_back(static_cast<GLshort>(pos.x + this->tilevertices[corner * 2 + 0]));
+				target.vertices.push_back(static_cast<GLshort>(pos.y + this->tilevertices[corner * 2 + 1]));
+				target.texcoords.push_back(texvertices[corner * 2 + 0]);
+				target.texcoords.push_back(texvertices[corner * 2 + 1]);
+			}
+		}
+	}
 
+	void submit_batches(const mapctrl::screenpair &screensize, const float *factor)
+	{
 		glPushMatrix();
 
 		glLoadIdentity();
@@ -394,170 +1148,767 @@ public:
 			glScalef(*factor, *factor, 0.0);
 			glTranslatef(-static_cast<float>(screensize.x) / 2, -static_cast<float>(screensize.y) / 2, 0.0);
 		}
-		glTranslatef(static_cast<float>(pos.x), static_cast<float>(pos.y), 0.0);
 
-		if (config::showwireframe) {
-			static const float colors[][3] =
-			{
-				{ 1.0f, 0.0f, 0.0f, },
-				{ 1.0f, 1.0f, 0.0f, },
-				{ 0.0f, 1.0f, 0.0f, },
-				{ 0.0f, 0.0f, 1.0f, },
-			};
-			const float *color = colors[layer.get_zoomlevel() % 4];
-			glColor4f(color[0], color[1], color[2], 1.0f);
+		glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
-			glEnableClientState(GL_VERTEX_ARRAY);
-			glVertexPointer(2, GL_SHORT, 0, this->tilevertices);
-			glDrawArrays(GL_LINES, 0, 8);
-			glDisableClientState(GL_VERTEX_ARRAY);
+		for (auto i = this->batches.begin(); i != this->batches.end(); ++i) {
+			auto &batch = i->second;
+			if (batch.vertices.empty()) continue;
 
-			if (false) {
-				static const short markvertices[] =
-				{
-					0, 0,
-					5, 0,
-					5, 5,
-					0, 5,
-				};
-				for (int i = 0; i < key.get_lod(); ++i) {
-					auto bit2 = key[i];
-					const float *markcolor = colors[bit2];
-					glColor4f(markcolor[0], markcolor[1], markcolor[2], 1.0f);
+			glBindTexture(GL_TEXTURE_2D, i->first);
+			glVertexPointer(2, GL_SHORT, 0, &batch.vertices[0]);
+			glTexCoordPointer(2, GL_FLOAT, 0, &batch.texcoords[0]);
+			glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(batch.vertices.size() / 2));
+		}
 
-					glPushMatrix();
+		glDisableClientState(GL_VERTEX_ARRAY);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 
-					glLoadIdentity();
-					glTranslatef(static_cast<float>(i) * 6.0f + 2.0f, 2.0f, 0.0f);
-					if (factor)
-						glScalef(*factor, *factor, 0.0f);
-					glTranslatef(static_cast<float>(pos.x), static_cast<float>(pos.y), 0.0f);
+		glPopMatrix();
+	}
 
-					glEnableClientState(GL_VERTEX_ARRAY);
-					glVertexPointer(2, GL_SHORT, 0, markvertices);
-					glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-					glDisableClientState(GL_VERTEX_ARRAY);
+#ifdef GL_OES_framebuffer_object
+	static void * get_procaddress(const char *name)
+	{
+#ifdef USE_SDL
+		return SDL_GL_GetProcAddress(name);
+#elif defined PLATFORM_IOS
+		if (!std::strcmp(name, "glGenFramebuffersOES")) return reinterpret_cast<void *>(glGenFramebuffersOES);
+		if (!std::strcmp(name, "glDeleteFramebuffersOES")) return reinterpret_cast<void *>(glDeleteFramebuffersOES);
+		if (!std::strcmp(name, "glBindFramebufferOES")) return reinterpret_cast<void *>(glBindFramebufferOES);
+		if (!std::strcmp(name, "glFramebufferTexture2DOES")) return reinterpret_cast<void *>(glFramebufferTexture2DOES);
+		if (!std::strcmp(name, "glCheckFramebufferStatusOES")) return reinterpret_cast<void *>(glCheckFramebufferStatusOES);
+		return nullptr;
+#endif
+	}
 
-					glPopMatrix();
-				}
+	bool prepare_scroll(const mapctrl::screenpair &screensize)
+	{
+		auto &sc = this->scroll;
+		if (sc.supported == -1) {
+			sc.supported = 0;
+			auto extensions = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+			if (extensions && std::strstr(extensions, "GL_OES_framebuffer_object")) {
+				// the headers declare the entry points only on request, and the library need not export them
+				sc.genframebuffers = reinterpret_cast<genframebuffersproc>(get_procaddress("glGenFramebuffersOES"));
+				sc.deleteframebuffers = reinterpret_cast<deleteframebuffersproc>(get_procaddress("glDeleteFramebuffersOES"));
+				sc.bindframebuffer = reinterpret_cast<bindframebufferproc>(get_procaddress("glBindFramebufferOES"));
+				sc.framebuffertexture2d = reinterpret_cast<framebuffertexture2dproc>(get_procaddress("glFramebufferTexture2DOES"));
+				sc.checkframebufferstatus = reinterpret_cast<checkframebufferstatusproc>(get_procaddress("glCheckFramebufferStatusOES"));
+				sc.supported = sc.genframebuffers && sc.deleteframebuffers && sc.bindframebuffer && sc.framebuffertexture2d && sc.checkframebufferstatus ? 1 : 0;
 			}
 		}
-		else {
-			GLuint texture = 0;
-			auto result = this->get_texture(key, timestamp, tiles, &texture);
-			if (draw && result.first) {
-				glBindTexture(GL_TEXTURE_2D, texture);
-				glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+		if (!sc.supported) return false;
+
+		if (sc.gltex[0] && sc.size.x == screensize.x && sc.size.y == screensize.y)
+			return true;
+
+		this->release_scroll();
+
+		// GL ES 1 only has power-of-two textures
+		sc.texsize = mapctrl::screenpair(1, 1);
+		while (sc.texsize.x < screensize.x) sc.texsize.x <<= 1;
+		while (sc.texsize.y < screensize.y) sc.texsize.y <<= 1;
+		sc.size = screensize;
+
+		GLint previous = 0;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING_OES, &previous);
+
+		glGenTextures(2, sc.gltex);
+		sc.genframebuffers(2, sc.fbo);
+		bool complete = true;
+		for (int i = 0; i < 2; ++i) {
+			glBindTexture(GL_TEXTURE_2D, sc.gltex[i]);
+			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, sc.texsize.x, sc.texsize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+			sc.bindframebuffer(GL_FRAMEBUFFER_OES, sc.fbo[i]);
+			sc.framebuffertexture2d(GL_FRAMEBUFFER_OES, GL_COLOR_ATTACHMENT0_OES, GL_TEXTURE_2D, sc.gltex[i], 0);
+			if (sc.checkframebufferstatus(GL_FRAMEBUFFER_OES) != GL_FRAMEBUFFER_COMPLETE_OES)
+				complete = false;
+		}
+		sc.bindframebuffer(GL_FRAMEBUFFER_OES, previous);
 
-				glEnableClientState(GL_VERTEX_ARRAY);
-				glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-				glVertexPointer(2, GL_SHORT, 0, this->tilevertices);
+		if (!complete) {
+			this->release_scroll();
+			sc.supported = 0;
+			return false;
+		}
+#ifdef LOGGING_TEXTURE
+		logger::info("creating scroll cache", sc.texsize.x, sc.texsize.y);
+#endif
+		return true;
+	}
 
-				int difflevel = layer.get_zoomlevel() - result.second;
-				if (difflevel == 0) {
-					static const GLshort texvertices[] = { 0, 0, 1, 0, 1, 1, 0, 1 };
-					glTexCoordPointer(2, GL_SHORT, 0, texvertices);
-				}
-				else {
-					auto targetpix = layer.get_pixel(tile);
-					float scale = std::pow(2.f, difflevel);
-					auto sourcepix = mapctrl::pixelpair(static_cast<int>(targetpix.x / scale), static_cast<int>(targetpix.y / scale));
-					auto sourcealignedpix = layer.get_pixel(layer.get_tile(sourcepix));
-
-					GLfloat x, y, w, h;
-					w = h = layer.get_tilesize() / scale / layer.get_tilesize();
-					x = (sourcepix.x - sourcealignedpix.x) / static_cast<float>(layer.get_tilesize());
-					y = (sourcepix.y - sourcealignedpix.y) / static_cast<float>(layer.get_tilesize());
-					GLfloat scaledtexvertices[] = { x, y, x + w, y, x + w, y + h, x, y + h };
-
-					glTexCoordPointer(2, GL_FLOAT, 0, scaledtexvertices);
-				}
+	void release_scroll()
+	{
+		auto &sc = this->scroll;
+		if (sc.gltex[0]) {
+			sc.deleteframebuffers(2, sc.fbo);
+			glDeleteTextures(2, sc.gltex);
+		}
+		sc.gltex[0] = sc.gltex[1] = 0;
+		sc.fbo[0] = sc.fbo[1] = 0;
+		sc.valid = false;
+	}
 
-				glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-				glDisableClientState(GL_VERTEX_ARRAY);
-				glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-			}
+	void draw_scrolled(int timestamp, tilecache *tiles, const mapctrl::screenpair &screensize, const mapctrl::tilelayer &layer)
+	{
+		auto &sc = this->scroll;
+		auto &nw = layer.get_pixelnw();
+		mapctrl::screenpair shift(sc.pixelnw.x - nw.x, sc.pixelnw.y - nw.y);
+
+		bool reuse = sc.valid && sc.zoomlevel == layer.get_zoomlevel() && std::abs(shift.x) < screensize.x && std::abs(shift.y) < screensize.y;
+		int back = 1 - sc.front;
+
+		GLint previous = 0;
+		GLint viewport[4];
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING_OES, &previous);
+		glGetIntegerv(GL_VIEWPORT, viewport);
+
+		sc.bindframebuffer(GL_FRAMEBUFFER_OES, sc.fbo[back]);
+		glViewport(0, 0, screensize.x, screensize.y);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		if (reuse) {
+			// what is still on the screen comes from the previous frame, and
+			// only the tiles reaching out of it are drawn again
+			this->draw_scrolltexture(sc.gltex[sc.front], shift);
+
+			std::pair<mapctrl::screenpair, mapctrl::screenpair> kept(
+				mapctrl::screenpair(std::max(shift.x, 0), std::max(shift.y, 0)),
+				mapctrl::screenpair(std::min(shift.x + screensize.x, screensize.x), std::min(shift.y + screensize.y, screensize.y)));
+			this->collect_batches(timestamp, tiles, layer, true, nullptr, &kept);
 		}
+		else
+			this->collect_batches(timestamp, tiles, layer, true, nullptr, nullptr);
+		this->submit_batches(screensize, nullptr);
 
-		glPopMatrix();
+		sc.bindframebuffer(GL_FRAMEBUFFER_OES, previous);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+		this->draw_scrolltexture(sc.gltex[back], mapctrl::screenpair(0, 0));
+
+		sc.front = back;
+		sc.valid = true;
+		sc.zoomlevel = layer.get_zoomlevel();
+		sc.pixelnw = nw;
 	}
 
-#ifdef IMPLEMENT_GPSPIN
-	virtual void draw_gpspin(const mapctrl::screenpair &screen, const pngtexture *texture, const mapctrl::screenpair &hotpoint)
+	// the texture holds the screen upside down, as GL puts the origin at the bottom left
+	void draw_scrolltexture(GLuint texture, const mapctrl::screenpair &pos)
 	{
-		if (!texture) return;
-
-		static const GLshort texvertices[] = { 0, 0, 1, 0, 1, 1, 0, 1 };
-		static const GLshort vertices[] = { 0, 0, 16, 0, 16, 16, 0, 16 };
+		auto &sc = this->scroll;
+		GLfloat w = static_cast<GLfloat>(sc.size.x) / sc.texsize.x;
+		GLfloat h = static_cast<GLfloat>(sc.size.y) / sc.texsize.y;
+		const GLshort vertices[] =
+		{
+			static_cast<GLshort>(pos.x), static_cast<GLshort>(pos.y),
+			static_cast<GLshort>(pos.x + sc.size.x), static_cast<GLshort>(pos.y),
+			static_cast<GLshort>(pos.x + sc.size.x), static_cast<GLshort>(pos.y + sc.size.y),
+			static_cast<GLshort>(pos.x), static_cast<GLshort>(pos.y + sc.size.y),
+		};
+		const GLfloat texvertices[] = { 0, h, w, h, w, 0, 0, 0 };
 
 		glPushMatrix();
 		glLoadIdentity();
-		glTranslatef(static_cast<float>(screen.x - hotpoint.x), static_cast<float>(screen.y - hotpoint.y), 0.0f);
 
-		glBindTexture(GL_TEXTURE_2D, texture->get_tex());
+		glBindTexture(GL_TEXTURE_2D, texture);
 		glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+		GLboolean blending = glIsEnabled(GL_BLEND);
+		glDisable(GL_BLEND);
 
 		glEnableClientState(GL_VERTEX_ARRAY);
 		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 		glVertexPointer(2, GL_SHORT, 0, vertices);
-		glTexCoordPointer(2, GL_SHORT, 0, texvertices);
+		glTexCoordPointer(2, GL_FLOAT, 0, texvertices);
 		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 		glDisableClientState(GL_VERTEX_ARRAY);
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 
+		if (blending)
+			glEnable(GL_BLEND);
 		glPopMatrix();
 	}
+#endif
+};
+#endif
+
+#ifdef USE_GLES2
+namespace shaders
+{
+	// every tile is an instance of the unit quad, placed at (x, y) and scaled to
+	// the tile size, showing texrect of its texture. The zoom factor scales
+	// around the center of the screen.
+	static const char *tile_vertex =
+		"attribute vec2 corner;\n"
+		"attribute vec3 placement;\n"
+		"attribute vec4 texrect;\n"
+		"uniform vec2 screensize;\n"
+		"uniform float factor;\n"
+		"varying vec2 texcoord;\n"
+		"void main()\n"
+		"{\n"
+		"	vec2 center = screensize * 0.5;\n"
+		"	vec2 pos = (placement.xy + corner * placement.z - center) * factor + center;\n"
+		"	gl_Position = vec4(pos.x / center.x - 1.0, 1.0 - pos.y / center.y, 0.0, 1.0);\n"
+		"	texcoord = texrect.xy + corner * texrect.zw;\n"
+		"}\n";
+
+	static const char *tile_fragment =
+		"precision mediump float;\n"
+		"uniform sampler2D tiletexture;\n"
+		"varying vec2 texcoord;\n"
+		"void main()\n"
+		"{\n"
+		"	gl_FragColor = texture2D(tiletexture, texcoord);\n"
+		"}\n";
+
+	static const char *solid_vertex =
+		"attribute vec2 position;\n"
+		"uniform vec2 screensize;\n"
+		"void main()\n"
+		"{\n"
+		"	vec2 center = screensize * 0.5;\n"
+		"	gl_Position = vec4(position.x / center.x - 1.0, 1.0 - position.y / center.y, 0.0, 1.0);\n"
+		"}\n";
+
+	static const char *solid_fragment =
+		"precision mediump float;\n"
+		"uniform vec4 color;\n"
+		"void main()\n"
+		"{\n"
+		"	gl_FragColor = color;\n"
+		"}\n";
+}
+
+class opengles2_renderer : public renderer
+{
+public:
+	opengles2_renderer(short tilesize)
+		: tilesize(tilesize), prepared(false), quadbuffer(0), drawinstanced(nullptr), attribdivisor(nullptr), screensize(0, 0)
+	{
+	}
+
+	~opengles2_renderer()
+	{
+		if (this->prepared) {
+			glDeleteBuffers(1, &this->quadbuffer);
+			glDeleteProgram(this->tileprogram.program);
+			glDeleteProgram(this->solidprogram.program);
+		}
+	}
+
+	bool prepare()
+	{
+		if (this->prepared) return true;
+
+		this->tileprogram.program = link_program(shaders::tile_vertex, shaders::tile_fragment);
+		this->solidprogram.program = link_program(shaders::solid_vertex, shaders::solid_fragment);
+		if (!this->tileprogram.program || !this->solidprogram.program)
+			return false;
+
+		auto &tp = this->tileprogram;
+		tp.corner = glGetAttribLocation(tp.program, "corner");
+		tp.placement = glGetAttribLocation(tp.program, "placement");
+		tp.texrect = glGetAttribLocation(tp.program, "texrect");
+		tp.screensize = glGetUniformLocation(tp.program, "screensize");
+		tp.factor = glGetUniformLocation(tp.program, "factor");
+		tp.texture = glGetUniformLocation(tp.program, "tiletexture");
+
+		auto &sp = this->solidprogram;
+		sp.position = glGetAttribLocation(sp.program, "position");
+		sp.screensize = glGetUniformLocation(sp.program, "screensize");
+		sp.color = glGetUniformLocation(sp.program, "color");
+
+		// two triangles, as one strip
+		static const GLfloat corners[] = { 0, 0, 1, 0, 0, 1, 1, 1 };
+		glGenBuffers(1, &this->quadbuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, this->quadbuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		auto extensions = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+		if (extensions && std::strstr(extensions, "GL_EXT_instanced_arrays")) {
+			this->drawinstanced = reinterpret_cast<drawinstancedproc>(get_procaddress("glDrawArraysInstancedEXT"));
+			this->attribdivisor = reinterpret_cast<attribdivisorproc>(get_procaddress("glVertexAttribDivisorEXT"));
+			if (!this->drawinstanced || !this->attribdivisor)
+				this->drawinstanced = nullptr;
+		}
+#ifdef LOGGING
+		logger::info("instanced tile drawing", this->drawinstanced ? "yes" : "no");
+#endif
+
+		this->prepared = true;
+		return true;
+	}
+
+	virtual void draw_tile(int timestamp, tilecache *tiles, const mapctrl::screenpair &screensize, const mapctrl::tilelayer &layer, const float *factor, bool draw, const mapctrl::tilepair &tile, const mapctrl::pixelpair &pixel)
+	{
+		auto found = tiles->get_texture(layer.get_quadkey(tile), timestamp);
+		this->batches.clear();
+		if (draw)
+			this->collect(layer, tile, pixel, found);
+		this->submit(screensize, factor);
+	}
+
+	virtual void draw_layer(int timestamp, tilecache *tiles, const mapctrl::screenpair &screensize, const mapctrl::tilelayer &layer, const float *factor, bool draw, const std::set<mapctrl::quadkey> *hidden)
+	{
+		// the instances kept from the previous layer belong to textures that may be gone
+		for (auto i = this->batches.begin(); i != this->batches.end(); ) {
+			if (i->second.empty())
+				this->batches.erase(i++);
+			else {
+				i->second.clear();
+				++i;
+			}
+		}
+
+		this->visible.find(timestamp, tiles, layer, hidden);
+		for (size_t i = 0; draw && i < this->visible.size(); ++i)
+			this->collect(layer, this->visible.tiles[i], this->visible.pixels[i], this->visible.found[i]);
+		this->submit(screensize, factor);
+	}
+
+#ifdef IMPLEMENT_GPSPIN
+	virtual void draw_gpspin(const mapctrl::screenpair &screen, const pngtexture *texture, const mapctrl::screenpair &hotpoint)
+	{
+		if (!texture) return;
+
+		std::vector<GLfloat> instance;
+		const GLfloat *texrect = texture->get_texrect();
+		add_instance(instance, screen.x - hotpoint.x, screen.y - hotpoint.y, 16, texrect[0], texrect[1], texrect[2], texrect[3]);
+
+		this->batches.clear();
+		this->batches[texture->get_tex()].swap(instance);
+		this->submit(this->screensize, nullptr);
+		this->batches.clear();
+	}
 
 	virtual void draw_gpspin_shadow(const mapctrl::screenpair &screen, float radius)
 	{
-		const int nummaxsegs = 50;
-		GLfloat vertices[nummaxsegs * 2];
-		int numsegs = nummaxsegs;
+		const int numsegs = 50;
+		GLfloat vertices[numsegs * 2];
 		for (int i = 0; i < numsegs; ++i) {
 			float theta = 2.0f * static_cast<float>(M_PI) * static_cast<float>(i) / static_cast<float>(numsegs);
-			vertices[i * 2 + 0] = radius * std::cos(theta);
-			vertices[i * 2 + 1] = radius * std::sin(theta);
+			vertices[i * 2 + 0] = screen.x + radius * std::cos(theta);
+			vertices[i * 2 + 1] = screen.y + radius * std::sin(theta);
 		}
 
-		glPushMatrix();
-		glLoadIdentity();
-		glTranslatef(static_cast<float>(screen.x), static_cast<float>(screen.y), 0.0f);
+		auto &sp = this->solidprogram;
+		glUseProgram(sp.program);
+		glUniform2f(sp.screensize, static_cast<GLfloat>(this->screensize.x), static_cast<GLfloat>(this->screensize.y));
+		glUniform4f(sp.color, 0.2f, 0.2f, 0.4f, 0.3f);
 
-		glColor4f(0.2f, 0.2f, 0.4f, 0.3f);
+		glEnableVertexAttribArray(sp.position);
+		glVertexAttribPointer(sp.position, 2, GL_FLOAT, GL_FALSE, 0, vertices);
+		glDrawArrays(GL_TRIANGLE_FAN, 0, numsegs);
+		glDisableVertexAttribArray(sp.position);
+	}
+#endif
 
-		glEnable(GL_LINE_SMOOTH);
-		glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
+private:
+	typedef void (GL_APIENTRYP drawinstancedproc)(GLenum mode, GLint first, GLsizei count, GLsizei primcount);
+	typedef void (GL_APIENTRYP attribdivisorproc)(GLuint index, GLuint divisor);
 
-		glEnableClientState(GL_VERTEX_ARRAY);
-		glVertexPointer(2, GL_FLOAT, 0, vertices);
-		glDrawArrays(GL_TRIANGLE_FAN, 0, numsegs);
-		glDisableClientState(GL_VERTEX_ARRAY);
+	struct tileshader
+	{
+		GLuint program;
+		GLint corner;
+		GLint placement;
+		GLint texrect;
+		GLint screensize;
+		GLint factor;
+		GLint texture;
+	};
 
-		glDisable(GL_LINE_SMOOTH);
+	struct solidshader
+	{
+		GLuint program;
+		GLint position;
+		GLint screensize;
+		GLint color;
+	};
 
-		glPopMatrix();
+	// x, y and size of the tile on the screen, then x, y, width and height in its texture
+	static const int INSTANCESIZE = 7;
+
+	const short tilesize;
+	bool prepared;
+	tileshader tileprogram;
+	solidshader solidprogram;
+	GLuint quadbuffer;
+	drawinstancedproc drawinstanced;
+	attribdivisorproc attribdivisor;
+	// the screen size of the last layer, for drawing the GPS pin on top of it
+	mapctrl::screenpair screensize;
+	std::map<GLuint, std::vector<GLfloat>> batches;
+	visibleset visible;
+	std::vector<GLfloat> expanded;
+
+	static void * get_procaddress(const char *name)
+	{
+#ifdef USE_SDL
+		return SDL_GL_GetProcAddress(name);
+#elif defined PLATFORM_IOS
+		if (!std::strcmp(name, "glDrawArraysInstancedEXT")) return reinterpret_cast<void *>(glDrawArraysInstancedEXT);
+		if (!std::strcmp(name, "glVertexAttribDivisorEXT")) return reinterpret_cast<void *>(glVertexAttribDivisorEXT);
+		return nullptr;
+#endif
+	}
+
+	static GLuint compile_shader(GLenum type, const char *source)
+	{
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, 1, &source, nullptr);
+		glCompileShader(shader);
+
+		GLint compiled = 0;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+		if (!compiled) {
+#ifdef LOGGING
+			char log[512];
+			glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+			logger::info("cannot compile shader", log);
+#endif
+			glDeleteShader(shader);
+			return 0;
+		}
+		return shader;
+	}
+
+	static GLuint link_program(const char *vertexsource, const char *fragmentsource)
+	{
+		GLuint vertex = compile_shader(GL_VERTEX_SHADER, vertexsource);
+		GLuint fragment = compile_shader(GL_FRAGMENT_SHADER, fragmentsource);
+		GLuint program = 0;
+		if (vertex && fragment) {
+			program = glCreateProgram();
+			glAttachShader(program, vertex);
+			glAttachShader(program, fragment);
+			glLinkProgram(program);
+
+			GLint linked = 0;
+			glGetProgramiv(program, GL_LINK_STATUS, &linked);
+			if (!linked) {
+				glDeleteProgram(program);
+				program = 0;
+			}
+		}
+
+		// the program keeps them alive as long as it needs them
+		if (vertex) glDeleteShader(vertex);
+		if (fragment) glDeleteShader(fragment);
+		return program;
+	}
+
+	static void add_instance(std::vector<GLfloat> &target, int x, int y, int size, GLfloat texx, GLfloat texy, GLfloat texw, GLfloat texh)
+	{
+		target.push_back(static_cast<GLfloat>(x));
+		target.push_back(static_cast<GLfloat>(y));
+		target.push_back(static_cast<GLfloat>(size));
+		target.push_back(texx);
+		target.push_back(texy);
+		target.push_back(texw);
+		target.push_back(texh);
+	}
+
+	// found is what the cache gave for the tile, and its key
+	void collect(const mapctrl::tilelayer &layer, const mapctrl::tilepair &tile, const mapctrl::pixelpair &pixel, const std::pair<mapctrl::quadkey, const pngtexture *> &found)
+	{
+		if (!found.second) return;
+		auto pos = get_tilescreen(layer, tile, pixel);
+
+		GLfloat x, y, w, h;
+		get_tiletexcoords(layer, tile, found.first.get_lod(), found.second->get_texrect(), &x, &y, &w, &h);
+		add_instance(this->batches[found.second->get_tex()], pos.x, pos.y, this->tilesize, x, y, w, h);
+	}
+
+	void submit(const mapctrl::screenpair &screensize, const float *factor)
+	{
+		this->screensize = screensize;
+		if (!this->prepare()) return;
+
+		auto &tp = this->tileprogram;
+		glUseProgram(tp.program);
+		glUniform2f(tp.screensize, static_cast<GLfloat>(screensize.x), static_cast<GLfloat>(screensize.y));
+		glUniform1f(tp.factor, factor ? *factor : 1.0f);
+		glUniform1i(tp.texture, 0);
+		glActiveTexture(GL_TEXTURE0);
+
+		glEnableVertexAttribArray(tp.corner);
+		glEnableVertexAttribArray(tp.placement);
+		glEnableVertexAttribArray(tp.texrect);
+
+		if (this->drawinstanced) {
+			glBindBuffer(GL_ARRAY_BUFFER, this->quadbuffer);
+			glVertexAttribPointer(tp.corner, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			this->attribdivisor(tp.placement, 1);
+			this->attribdivisor(tp.texrect, 1);
+
+			for (auto i = this->batches.begin(); i != this->batches.end(); ++i) {
+				auto &instances = i->second;
+				if (instances.empty()) continue;
+
+				glBindTexture(GL_TEXTURE_2D, i->first);
+				glVertexAttribPointer(tp.placement, 3, GL_FLOAT, GL_FALSE, INSTANCESIZE * sizeof(GLfloat), &instances[0]);
+				glVertexAttribPointer(tp.texrect, 4, GL_FLOAT, GL_FALSE, INSTANCESIZE * sizeof(GLfloat), &instances[3]);
+				this->drawinstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(instances.size() / INSTANCESIZE));
+			}
+
+			this->attribdivisor(tp.placement, 0);
+			this->attribdivisor(tp.texrect, 0);
+		}
+		else {
+			// without instancing, every vertex of the two triangles carries its instance along
+			static const GLfloat corners[] = { 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1 };
+			const int vertexsize = 2 + INSTANCESIZE;
+
+			for (auto i = this->batches.begin(); i != this->batches.end(); ++i) {
+				auto &instances = i->second;
+				if (instances.empty()) continue;
+
+				this->expanded.clear();
+				for (size_t j = 0; j < instances.size(); j += INSTANCESIZE) {
+					for (int k = 0; k < 6; ++k) {
+						this->expanded.push_back(corners[k * 2 + 0]);
+						this->expanded.push_back(corners[k * 2 + 1]);
+						this->expanded.insert(this->expanded.end(), instances.begin() + j, instances.begin() + j + INSTANCESIZE);
+					}
+				}
+
+				glBindTexture(GL_TEXTURE_2D, i->first);
+				glVertexAttribPointer(tp.corner, 2, GL_FLOAT, GL_FALSE, vertexsize * sizeof(GLfloat), &this->expanded[0]);
+				glVertexAttribPointer(tp.placement, 3, GL_FLOAT, GL_FALSE, vertexsize * sizeof(GLfloat), &this->expanded[2]);
+				glVertexAttribPointer(tp.texrect, 4, GL_FLOAT, GL_FALSE, vertexsize * sizeof(GLfloat), &this->expanded[5]);
+				glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(this->expanded.size() / vertexsize));
+			}
+		}
+
+		glDisableVertexAttribArray(tp.corner);
+		glDisableVertexAttribArray(tp.placement);
+		glDisableVertexAttribArray(tp.texrect);
 	}
+
+	opengles2_renderer(const opengles2_renderer &r);
+	opengles2_renderer & operator=(const opengles2_renderer &r);
+};
 #endif
+#else
+// draws into an RGBA framebuffer in memory, for builds without a GPU
+class software_renderer : public renderer
+{
+public:
+	software_renderer(short tilesize)
+		: size(0, 0)
+	{
+	}
+
+	virtual void draw_tile(int timestamp, tilecache *tiles, const mapctrl::screenpair &screensize, const mapctrl::tilelayer &layer, const float *factor, bool draw, const mapctrl::tilepair &tile, const mapctrl::pixelpair &pixel)
+	{
+		auto found = tiles->get_texture(layer.get_quadkey(tile), timestamp);
+		if (draw)
+			this->draw_found(screensize, layer, factor, tile, pixel, found);
+	}
+
+	virtual void draw_layer(int timestamp, tilecache *tiles, const mapctrl::screenpair &screensize, const mapctrl::tilelayer &layer, const float *factor, bool draw, const std::set<mapctrl::quadkey> *hidden)
+	{
+		this->visible.find(timestamp, tiles, layer, hidden);
+		for (size_t i = 0; draw && i < this->visible.size(); ++i)
+			this->draw_found(screensize, layer, factor, this->visible.tiles[i], this->visible.pixels[i], this->visible.found[i]);
+	}
+
+	virtual void begin_frame(const mapctrl::screenpair &screensize)
+	{
+		this->size = mapctrl::screenpair(std::max(screensize.x, 0), std::max(screensize.y, 0));
+		this->framebuffer.assign(this->size.x * this->size.y * 4, 0);
+		for (size_t i = 3; i < this->framebuffer.size(); i += 4)
+			this->framebuffer[i] = 0xff;
+	}
+
+	virtual const unsigned char * get_framebuffer(mapctrl::screenpair *size) const
+	{
+		if (size) *size = this->size;
+		return this->framebuffer.empty() ? nullptr : &this->framebuffer[0];
+	}
 
 private:
-	GLshort *tilevertices;
+	std::vector<unsigned char> framebuffer;
+	mapctrl::screenpair size;
+	visibleset visible;
 
-	std::pair<bool, int> get_texture(const mapctrl::quadkey &key, int timestamp, tilecache *tiles, GLuint *texture)
+	// found is what the cache gave for the tile, and its key
+	void draw_found(const mapctrl::screenpair &screensize, const mapctrl::tilelayer &layer, const float *factor, const mapctrl::tilepair &tile, const mapctrl::pixelpair &pixel, const std::pair<mapctrl::quadkey, const pngtexture *> &found)
 	{
-		auto result = tiles->get_texture(key, timestamp);
-		if (!result.second)
-			return std::make_pair(false, 0);
-		*texture = result.second->get_tex();
-		return std::make_pair(true, result.first.get_lod());
+		if (!found.second) return;
+
+		auto pos = get_tilescreen(layer, tile, pixel);
+#ifdef LOGGING_VISIBLETILES
+		logger::info(found.first.str(), tile.x, tile.y);
+		logger::info(" -> ", pos.x, pos.y);
+#endif
+		auto texture = found.second;
+		int tilesize = static_cast<int>(layer.get_tilesize());
+		int difflevel = layer.get_zoomlevel() - found.first.get_lod();
+
+		if (!factor && difflevel == 0 && texture->get_width() == tilesize && texture->get_height() == tilesize) {
+			this->copy_tile(texture, pos);
+			return;
+		}
+
+		// the part of the texture to draw the tile with, when the texture is an ancestor of it
+		float texscale = static_cast<float>(texture->get_width()) / tilesize;
+		float srcx = 0.0f, srcy = 0.0f, srcsize = static_cast<float>(tilesize);
+		if (difflevel != 0) {
+			auto targetpix = layer.get_pixel(tile);
+			float scale = std::pow(2.f, difflevel);
+			auto sourcepix = mapctrl::pixelpair(static_cast<int>(targetpix.x / scale), static_cast<int>(targetpix.y / scale));
+			auto sourcealignedpix = layer.get_pixel(layer.get_tile(sourcepix));
+
+			srcsize = tilesize / scale;
+			srcx = static_cast<float>(sourcepix.x - sourcealignedpix.x);
+			srcy = static_cast<float>(sourcepix.y - sourcealignedpix.y);
+		}
+
+		// where the tile lands, scaled around the screen center like the GL renderers do
+		float dstx = static_cast<float>(pos.x), dsty = static_cast<float>(pos.y), dstsize = static_cast<float>(tilesize);
+		if (factor) {
+			float centerx = static_cast<float>(screensize.x) / 2;
+			float centery = static_cast<float>(screensize.y) / 2;
+			dstx = centerx + (dstx - centerx) * *factor;
+			dsty = centery + (dsty - centery) * *factor;
+			dstsize *= *factor;
+		}
+
+		this->scale_tile(texture, srcx * texscale, srcy * texscale, srcsize * texscale, dstx, dsty, dstsize);
+	}
+
+	// the tile is drawn texel for texel
+	void copy_tile(const pngtexture *texture, const mapctrl::screenpair &pos)
+	{
+		int width = texture->get_width();
+		int x0 = std::max(pos.x, 0), x1 = std::min(pos.x + width, this->size.x);
+		int y0 = std::max(pos.y, 0), y1 = std::min(pos.y + texture->get_height(), this->size.y);
+		if (x0 >= x1) return;
+
+		auto pixels = texture->get_pixels();
+		for (int y = y0; y < y1; ++y) {
+			auto src = pixels + ((y - pos.y) * width + (x0 - pos.x)) * 4;
+			std::memcpy(&this->framebuffer[(y * this->size.x + x0) * 4], src, (x1 - x0) * 4);
+		}
+	}
+
+	// draws the square of srcsize texels at (srcx, srcy) onto the square of dstsize
+	// pixels at (dstx, dsty), filtering bilinearly; a pixel is covered when its center is
+	void scale_tile(const pngtexture *texture, float srcx, float srcy, float srcsize, float dstx, float dsty, float dstsize)
+	{
+		if (dstsize <= 0.0f) return;
+
+		int x0 = std::max(static_cast<int>(std::ceil(dstx - 0.5f)), 0);
+		int x1 = std::min(static_cast<int>(std::ceil(dstx + dstsize - 0.5f)), this->size.x);
+		int y0 = std::max(static_cast<int>(std::ceil(dsty - 0.5f)), 0);
+		int y1 = std::min(static_cast<int>(std::ceil(dsty + dstsize - 0.5f)), this->size.y);
+		if (x0 >= x1 || y0 >= y1) return;
+
+		// texel positions are walked in 16.16 fixed point, measured from texel centers
+		float ratio = srcsize / dstsize;
+		int step = static_cast<int>(ratio * 65536.0f);
+		int ustart = static_cast<int>((srcx + (x0 + 0.5f - dstx) * ratio - 0.5f) * 65536.0f);
+		int vstart = static_cast<int>((srcy + (y0 + 0.5f - dsty) * ratio - 0.5f) * 65536.0f);
+
+		int width = texture->get_width();
+		int height = texture->get_height();
+		auto pixels = texture->get_pixels();
+
+		for (int y = y0, v = vstart; y < y1; ++y, v += step) {
+			int texy = std::min(std::max(v, 0) >> 16, height - 1);
+			int weighty = v < 0 ? 0 : (v >> 8) & 0xff;
+			auto row0 = pixels + texy * width * 4;
+			auto row1 = pixels + std::min(texy + 1, height - 1) * width * 4;
+			auto dst = &this->framebuffer[(y * this->size.x + x0) * 4];
+
+			for (int x = x0, u = ustart; x < x1; ++x, u += step, dst += 4) {
+				int texx = std::min(std::max(u, 0) >> 16, width - 1);
+				int weightx = u < 0 ? 0 : (u >> 8) & 0xff;
+				int nextx = std::min(texx + 1, width - 1);
+				sample(row0 + texx * 4, row0 + nextx * 4, row1 + texx * 4, row1 + nextx * 4, weightx, weighty, dst);
+			}
+		}
+	}
+
+	// blends the four texels around a point with weights out of 256, first
+	// vertically and then horizontally; both paths round the same way
+	static void sample(const unsigned char *p00, const unsigned char *p10, const unsigned char *p01, const unsigned char *p11, int weightx, int weighty, unsigned char *dst)
+	{
+#ifdef __SSE2__
+		__m128i zero = _mm_setzero_si128();
+		__m128i top = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128(load32(p00)), _mm_cvtsi32_si128(load32(p10))), zero);
+		__m128i bottom = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128(load32(p01)), _mm_cvtsi32_si128(load32(p11))), zero);
+
+		__m128i column = _mm_srli_epi16(_mm_add_epi16(
+			_mm_mullo_epi16(top, _mm_set1_epi16(static_cast<short>(256 - weighty))),
+			_mm_mullo_epi16(bottom, _mm_set1_epi16(static_cast<short>(weighty)))), 8);
+
+		__m128i weights = _mm_unpacklo_epi64(_mm_set1_epi16(static_cast<short>(256 - weightx)), _mm_set1_epi16(static_cast<short>(weightx)));
+		__m128i products = _mm_mullo_epi16(column, weights);
+		__m128i blended = _mm_srli_epi16(_mm_add_epi16(products, _mm_srli_si128(products, 8)), 8);
+
+		int result = _mm_cvtsi128_si32(_mm_packus_epi16(blended, zero));
+		std::memcpy(dst, &result, 4);
+#else
+		for (int i = 0; i < 4; ++i) {
+			int left = (p00[i] * (256 - weighty) + p01[i] * weighty) >> 8;
+			int right = (p10[i] * (256 - weighty) + p11[i] * weighty) >> 8;
+			dst[i] = static_cast<unsigned char>((left * (256 - weightx) + right * weightx) >> 8);
+		}
+#endif
+	}
+
+#ifdef __SSE2__
+	static int load32(const unsigned char *p)
+	{
+		int value;
+		std::memcpy(&value, p, 4);
+		return value;
 	}
+#endif
+
+	software_renderer(const software_renderer &r);
+	software_renderer & operator=(const software_renderer &r);
 };
 #endif
 
-renderer * renderer::create(short tilesize)
+renderer * renderer::create(short tilesize, renderertype type)
 {
+	switch (type) {
+	case AUTO:
 #ifdef PLATFORM_CLR
-	return new wpf_renderer(tilesize);
+		return new wpf_renderer(tilesize);
+#elif defined USE_GLES2
+		return new opengles2_renderer(tilesize);
+#elif defined USE_OPENGL
+		return new opengl_renderer(tilesize);
 #else
-	return new opengl_renderer(tilesize);
+		return new software_renderer(tilesize);
 #endif
+#if defined USE_OPENGL && !defined USE_GLES2
+	case OPENGLES1:
+		return new opengl_renderer(tilesize);
+#endif
+#ifdef USE_GLES2
+	case OPENGLES2:
+		return new opengles2_renderer(tilesize);
+#endif
+#if !defined PLATFORM_CLR && !defined USE_OPENGL
+	case SOFTWARE:
+		return new software_renderer(tilesize);
+#endif
+	default:
+		break;
+	}
+	return nullptr;
 }
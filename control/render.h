@@ -21,6 +21,7 @@ class tilecache;
 struct pngtexture
 {
 	static pngtexture * load(tilecache *enclosing, const std::string &path);
+	static pngtexture * load(tilecache *enclosing, const void *data, unsigned int size);
 
 	virtual ~pngtexture()
 	{
@@ -28,14 +29,54 @@ struct pngtexture
 
 	virtual bool is_bound() const = 0;
 	virtual void bind() = 0;
+	// gives up what bind() handed over, keeping the pixels to bind again from
+	virtual void unbind() = 0;
+	// how much bind() has to hand over to the graphics system
+	virtual unsigned int get_numbytes() const = 0;
+	// how much the image kept in memory to bind from takes
+	virtual unsigned int get_numresidentbytes() const = 0;
+	// how much the image takes in the graphics system, once bound
+	virtual unsigned int get_numboundbytes() const = 0;
 
 #ifdef PLATFORM_CLR
 	virtual System::Windows::Media::ImageSource^ get_tex() const = 0;
-#else
+#elif defined USE_OPENGL
 	virtual GLuint get_tex() const = 0;
+	// x, y, width and height of the image inside get_tex(), in texture coordinates
+	virtual const GLfloat * get_texrect() const = 0;
+#else
+	// RGBA rows without padding
+	virtual const unsigned char * get_pixels() const = 0;
+	virtual int get_width() const = 0;
+	virtual int get_height() const = 0;
 #endif
 };
 
+#ifdef USE_OPENGL
+// Keeps tiles in fixed-size slots of a few large textures, so that tiles
+// coming and going update existing texture objects instead of creating and
+// deleting them. Must only be used on the thread that owns the GL context.
+struct tileatlas
+{
+	virtual ~tileatlas()
+	{
+	}
+
+	// returns -1 if the image does not fit in a slot
+	virtual int allocate(GLint mode, int width, int height, const void *pixels) = 0;
+	virtual void release(int slot) = 0;
+
+	virtual GLuint get_tex(int slot) const = 0;
+	virtual void get_texrect(int slot, GLfloat *rect) const = 0;
+
+	// slots handed out from pages already there, and pages created for want of a free slot
+	virtual std::pair<unsigned int, unsigned int> get_numallocations() const = 0;
+
+	// pages that go empty are kept as long as they are needed for numslotskept slots
+	static tileatlas * create(short tilesize, unsigned int numslotskept);
+};
+#endif
+
 #ifdef PLATFORM_CLR
 struct render_context
 {
@@ -51,6 +92,30 @@ struct renderer
 #endif
 
 	virtual void draw_tile(int timestamp, tilecache *tiles, const mapctrl::screenpair &screensize, const mapctrl::tilelayer &layer, const float *factor, bool draw, const mapctrl::tilepair &tile, const mapctrl::pixelpair &pixel) = 0;
+	// draws every visible tile of the layer but the hidden ones, which are not asked
+	// for either; unless overridden, one by one with draw_tile
+	virtual void draw_layer(int timestamp, tilecache *tiles, const mapctrl::screenpair &screensize, const mapctrl::tilelayer &layer, const float *factor, bool draw, const std::set<mapctrl::quadkey> *hidden = nullptr);
+
+	// while scrolling, draw_layer may shift what it drew for the layer before
+	// instead of drawing all of it again, until invalidate() says the tiles changed
+	virtual void set_scrolling(bool scrolling)
+	{
+	}
+
+	virtual void invalidate()
+	{
+	}
+
+	// called before anything is drawn for a frame
+	virtual void begin_frame(const mapctrl::screenpair &screensize)
+	{
+	}
+
+	// the RGBA rows drawn so far, for renderers that draw into memory
+	virtual const unsigned char * get_framebuffer(mapctrl::screenpair *size) const
+	{
+		return nullptr;
+	}
 
 #ifdef IMPLEMENT_GPSPIN
 	virtual void draw_gpspin(const mapctrl::screenpair &screen, const pngtexture *texture, const mapctrl::screenpair &hotpoint) = 0;
@@ -61,5 +126,14 @@ struct renderer
 	{
 	}
 
-	static renderer * create(short tilesize);
+	enum renderertype
+	{
+		AUTO,
+		OPENGLES1,
+		OPENGLES2,
+		SOFTWARE,
+	};
+
+	// AUTO picks what the platform draws with; returns nullptr if the type is not built in
+	static renderer * create(short tilesize, renderertype type = AUTO);
 };
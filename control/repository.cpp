@@ -25,13 +25,90 @@ using namespace System::IO;
 using namespace msclr::interop;
 #endif
 
+tilearchive::tilearchive(mappedfile *mapped)
+	: mapped(mapped), entries(nullptr), keys(nullptr), numentries(0)
+{
+}
+
+tilearchive * tilearchive::open(const std::string &abspath, int lod)
+{
+	std::unique_ptr<mappedfile> mapped(mappedfile::open(abspath));
+	if (!mapped.get()) return nullptr;
+
+	auto data = mapped->get_data();
+	auto size = mapped->get_size();
+	if (size < sizeof(archive::header)) return nullptr;
+
+	auto head = reinterpret_cast<const archive::header *>(data);
+	if (!std::equal(archive::signature, archive::signature + 4, head->signature)) return nullptr;
+	if (head->version != archive::version) return nullptr;
+	if (head->lod != static_cast<unsigned int>(lod)) return nullptr;
+
+	bool indexonly = (head->flags & archive::INDEXONLY) != 0;
+	auto entrysize = indexonly ? sizeof(archive::uint64) : sizeof(archive::entry);
+	auto indexsize = static_cast<archive::uint64>(head->numentries) * entrysize;
+	if (sizeof(archive::header) + indexsize > size) return nullptr;
+	// the tiles must come after the index, or an entry could point into it
+	if (!indexonly && head->dataoffset < sizeof(archive::header) + indexsize) return nullptr;
+
+	std::unique_ptr<tilearchive> opened(new tilearchive(mapped.release()));
+	if (indexonly)
+		opened->keys = reinterpret_cast<const archive::uint64 *>(data + sizeof(archive::header));
+	else
+		opened->entries = reinterpret_cast<const archive::entry *>(data + sizeof(archive::header));
+	opened->numentries = head->numentries;
+	return opened.release();
+}
+
+bool tilearchive::contains(const quadkey &key) const
+{
+	auto needle = static_cast<archive::uint64>(key.get_key());
+
+	if (this->keys)
+		return std::binary_search(this->keys, this->keys + this->numentries, needle);
+
+	archive::entry e;
+	e.key = needle;
+	return std::binary_search(this->entries, this->entries + this->numentries, e);
+}
+
+std::pair<const void *, unsigned int> tilearchive::find(const quadkey &key) const
+{
+	if (!this->entries)
+		return std::make_pair(static_cast<const void *>(nullptr), 0U);
+
+	archive::entry needle;
+	needle.key = static_cast<archive::uint64>(key.get_key());
+
+	auto end = this->entries + this->numentries;
+	auto found = std::lower_bound(this->entries, end, needle);
+	if (found == end || found->key != needle.key)
+		return std::make_pair(static_cast<const void *>(nullptr), 0U);
+
+	// a corrupt entry must not reach outside the tiles, nor wrap around
+	auto head = reinterpret_cast<const archive::header *>(this->mapped->get_data());
+	auto mapsize = static_cast<archive::uint64>(this->mapped->get_size());
+	if (found->offset < head->dataoffset || found->size > mapsize || found->offset > mapsize - found->size)
+		return std::make_pair(static_cast<const void *>(nullptr), 0U);
+
+	auto data = this->mapped->get_data() + static_cast<size_t>(found->offset);
+	return std::make_pair(static_cast<const void *>(data), found->size);
+}
+
 repository::repository(const std::string &rootdir)
 	: tilerootdir(path::combine(rootdir, "tiles")), combinefactor(4)
 {
+	this->open_archives(rootdir, mapcontrol::ROAD, this->roadarchives);
+	this->open_archives(rootdir, mapcontrol::HYBRID, this->hybridarchives);
 }
 
 bool repository::exists(const quadkey &key, mapcontrol::mapstyle style) const
 {
+	// loose files stay a fallback, for the tiles downloaded after the packs were made
+	auto indexed = this->get_archive(key.get_lod(), style);
+	if (indexed && indexed->contains(key))
+		return true;
+
 	auto abspath = this->get_absolutepath(key, style);
 	return file::exists(abspath);
 }
@@ -42,6 +119,47 @@ std::string repository::get_absolutepath(const quadkey &key, mapcontrol::mapstyl
 	return path::combine(this->tilerootdir, relpath);
 }
 
+bool repository::is_packed(int lod, mapcontrol::mapstyle style) const
+{
+	auto packed = this->get_archive(lod, style);
+	return packed && !packed->is_indexonly();
+}
+
+bool repository::is_indexed(int lod, mapcontrol::mapstyle style) const
+{
+	return this->get_archive(lod, style) != nullptr;
+}
+
+quadkey repository::find_available(const quadkey &key, mapcontrol::mapstyle style) const
+{
+	for (auto current = key; ; current = current.upper()) {
+		auto indexed = this->get_archive(current.get_lod(), style);
+		if (!indexed || indexed->contains(current))
+			return current;
+		if (!current.has_upper())
+			return quadkey::epsilon();
+	}
+}
+
+std::pair<const void *, unsigned int> repository::get_packed(const quadkey &key, mapcontrol::mapstyle style) const
+{
+	auto packed = this->get_archive(key.get_lod(), style);
+	if (!packed)
+		return std::make_pair(static_cast<const void *>(nullptr), 0U);
+	return packed->find(key);
+}
+
+char repository::get_stylecode(mapcontrol::mapstyle style)
+{
+	switch (style) {
+	case mapcontrol::ROAD:
+		return 'r';
+	case mapcontrol::HYBRID:
+		return 'h';
+	}
+	return 'r';
+}
+
 #ifdef IMPLEMENT_DOWNLOAD
 std::string repository::get_url(const quadkey &key, mapcontrol::mapstyle style) const
 {
@@ -99,32 +217,98 @@ std::string repository::get_relativepath(const quadkey &key, mapcontrol::mapstyl
 	return s.str();
 }
 
+void repository::open_archives(const std::string &rootdir, mapcontrol::mapstyle style, std::unique_ptr<tilearchive> *archives)
+{
+	auto packdir = path::combine(rootdir, archive::dirname);
+	auto stylecode = get_stylecode(style);
+
+	for (int lod = 1; lod < MAXLOD; ++lod) {
+		auto abspath = path::combine(packdir, archive::get_filename(stylecode, lod));
+		archives[lod].reset(tilearchive::open(abspath, lod));
+		if (!archives[lod].get()) {
+			abspath = path::combine(packdir, archive::get_filename(stylecode, lod, true));
+			archives[lod].reset(tilearchive::open(abspath, lod));
+		}
+#ifdef LOGGING
+		if (archives[lod].get())
+			logger::info("archive", abspath, archives[lod]->get_numentries());
+#endif
+	}
+}
+
+const tilearchive * repository::get_archive(int lod, mapcontrol::mapstyle style) const
+{
+	if (lod <= 0 || lod >= MAXLOD) return nullptr;
+
+	switch (style) {
+	case mapcontrol::ROAD:
+		return this->roadarchives[lod].get();
+	case mapcontrol::HYBRID:
+		return this->hybridarchives[lod].get();
+	}
+	return nullptr;
+}
+
+// seconds since some fixed point, for timing lock waits
+static double get_seconds()
+{
+#if defined PLATFORM_WIN32 || defined PLATFORM_CLR
+	LARGE_INTEGER freq, current;
+	::QueryPerformanceFrequency(&freq);
+	::QueryPerformanceCounter(&current);
+	return static_cast<double>(current.QuadPart) / freq.QuadPart;
+#else
+	struct timeval current;
+	gettimeofday(&current, NULL);
+	return current.tv_sec + current.tv_usec / 1000000.0;
+#endif
+}
+
 pngtexture_queued::~pngtexture_queued()
 {
-#ifdef USE_OPENGL
+	if (this->enclosing)
+		this->enclosing->unlink_bound(this);
+#if defined USE_OPENGL || defined PLATFORM_HEADLESS
 	if (this->enclosing)
 		this->enclosing->enqueue_useless_texture(this->tex);
 #endif
 }
 
-tilecache::tilecache(const std::string &rootdir, unsigned int tilesize, unsigned int numtileslimit)
-	: repos(rootdir), tilesize(tilesize), tilestyle(mapcontrol::ROAD), flagterminate(false), numtileslimit(numtileslimit), dirty(false), on_tileloaded(nullptr)
+tilecache::tilecache(const std::string &rootdir, unsigned int tilesize, size_t maxbytes, size_t maxboundbytes, size_t maxencodedbytes, unsigned int numworkers)
+	: repos(rootdir), tilesize(tilesize), tilestyle(mapcontrol::ROAD), numworkers(numworkers ? numworkers : thread::get_numcores()), flagterminate(false), maxbytes(maxbytes), maxboundbytes(maxboundbytes), numboundbytes(0), boundcoldest(nullptr), boundhottest(nullptr), dirty(false), lockwait(std::make_pair(0U, 0.0)), maxencodedbytes(maxencodedbytes), encodedclock(0), numencodedbytes(0), numencodedhits(std::make_pair(0U, 0U)), focuslod(0), focus(std::make_pair(0.0, 0.0)), focustimestamp(0), prefetchtimestamp(0), generation(0), numskipped(0), numdiscarded(0), on_tileloaded(nullptr)
 {
+#ifdef USE_OPENGL
+	// evicted tiles hold on to their slots until the next frame destroys them;
+	// tiles are counted as RGB, the smallest they come in
+	size_t numslotskept = maxboundbytes / (tilesize * tilesize * 3) * 2;
+	this->atlas.reset(tileatlas::create(static_cast<short>(tilesize), static_cast<unsigned int>(std::min<size_t>(numslotskept, static_cast<unsigned int>(-1)))));
+#endif
 }
 
 tilecache::~tilecache()
 {
-	if (this->worker.get()) {
-		this->flagterminate = true;
-
+	if (!this->workers.empty()) {
 		this->quemutex->lock();
 		{
-			this->quecond->signal();
+			this->flagterminate = true;
+			this->quecond->broadcast();
 		}
 		this->quemutex->unlock();
 
-		this->worker->waitjoin();
+		for (auto i = this->workers.begin(); i != this->workers.end(); ++i) {
+			(*i)->waitjoin();
+			delete *i;
+		}
 	}
+
+	for (auto i = this->arrivals.begin(); i != this->arrivals.end(); ++i)
+		delete i->tex;
+
+	// the trie hands its textures over to useless, which must still be alive
+	this->tiletextures.clear();
+#if defined USE_OPENGL || defined PLATFORM_HEADLESS
+	this->useless.clear();
+#endif
 }
 
 #ifdef PLATFORM_CLR
@@ -144,12 +328,20 @@ static int tilecache_thread_entry(void *data)
 
 bool tilecache::initialize(tileloadedhandler handler)
 {
+	this->uploadtimer.reset(progresstimer::create());
 	this->mapmutex.reset(mutex::create());
 	this->quemutex.reset(mutex::create());
+	this->arrivemutex.reset(mutex::create());
+	this->encodedmutex.reset(mutex::create());
 	this->quecond.reset(condvar::create());
 
 	this->on_tileloaded = handler;
-	this->worker.reset(thread::create(tilecache_thread_entry, this));
+	for (unsigned int i = 0; i < this->numworkers; ++i)
+		this->workers.push_back(thread::create(tilecache_thread_entry, this));
+
+#ifdef LOGGING
+	logger::info("decoding threads", this->numworkers);
+#endif
 	return true;
 }
 
@@ -158,64 +350,356 @@ void tilecache::work()
 	this->quemutex->lock();
 
 	while (!this->flagterminate) {
-		this->quecond->wait(*this->quemutex);
+		if (this->requested.empty()) {
+			this->quecond->wait(*this->quemutex);
+			continue;
+		}
 
-		while (!this->requested.empty()) {
-			auto victim = *this->requested.begin();
-			this->requested.erase(victim.first);
-			this->quemutex->unlock();
+		auto victim = *this->requested.begin();
+		this->requestindex.erase(victim.key);
+		this->requested.erase(this->requested.begin());
 
-			auto path = this->repos.get_absolutepath(victim.first, this->tilestyle);
-			std::unique_ptr<pngtexture> tex(pngtexture::load(this, path));
+		// the frames since then have not asked for it, so it is off the screen,
+		// or a newer prediction has replaced it
+		if (!victim.fallback && victim.timestamp < (victim.prefetched ? this->prefetchtimestamp : this->focustimestamp)) {
+			this->numskipped++;
+			continue;
+		}
+
+		this->loading.insert(victim.key);
+		this->quemutex->unlock();
+
+		std::unique_ptr<pngtexture> tex(this->load(victim.key, victim.style));
 
 #ifdef IMPLEMENT_DOWNLOAD
-			if (!tex.get() && victim.second)
-				this->download(victim.first, this->tilestyle, victim.second);
+		if (!tex.get() && victim.timestamp)
+			this->download(victim.key, victim.style, victim.timestamp, victim.generation);
 #else
-			if (!tex.get() && victim.second && victim.first.has_upper()) {
-				this->quemutex->lock();
-				{
-					this->requested.insert(std::make_pair(victim.first.upper(), victim.second));
-				}
-				this->quemutex->unlock();
+		if (!tex.get() && victim.timestamp && victim.key.has_upper()) {
+			this->quemutex->lock();
+			if (victim.generation == this->generation) {
+				this->enqueue(victim.key.upper(), victim.timestamp, victim.prefetched, true);
+				this->quecond->signal();
 			}
+			this->quemutex->unlock();
+		}
 #endif
 
-			this->insert_tile(victim.first, victim.second, tex.get() ? tex.release() : nullptr);
+		// stays in loading until the drawing side takes it in, so that it is not asked for twice
+		this->insert_tile(victim.key, victim.timestamp, victim.generation, tex.get() ? tex.release() : nullptr);
 
-			this->quemutex->lock();
+		this->quemutex->lock();
+	}
+
+	this->quemutex->unlock();
+}
+
+pngtexture * tilecache::load(const quadkey &key, mapcontrol::mapstyle style)
+{
+	std::vector<unsigned char> bytes;
+	if (this->find_encoded(key, style, bytes))
+		return pngtexture::load(this, &bytes[0], static_cast<unsigned int>(bytes.size()));
+
+	// a tile missing from the pack may still be there as a loose file, like a downloaded one
+	std::pair<const void *, unsigned int> data(nullptr, 0U);
+	std::unique_ptr<mappedfile> mapped;
+	if (this->repos.is_packed(key.get_lod(), style))
+		data = this->repos.get_packed(key, style);
+	if (!data.first) {
+		mapped.reset(mappedfile::open(this->repos.get_absolutepath(key, style)));
+		if (mapped.get())
+			data = std::make_pair(static_cast<const void *>(mapped->get_data()), static_cast<unsigned int>(mapped->get_size()));
+	}
+	if (!data.first) return nullptr;
+
+	// a file that does not decode is not kept, so that it is read again next time
+	auto tex = pngtexture::load(this, data.first, data.second);
+	if (tex)
+		this->keep_encoded(key, style, data.first, data.second);
+	return tex;
+}
+
+// copies the kept file out, so that it is decoded without holding encodedmutex
+bool tilecache::find_encoded(const quadkey &key, mapcontrol::mapstyle style, std::vector<unsigned char> &bytes)
+{
+	if (!this->maxencodedbytes) return false;
+
+	bool found = false;
+	this->encodedmutex->lock();
+	{
+		auto i = this->encoded.find(std::make_pair(key, style));
+		if (i != this->encoded.end()) {
+			bytes = i->second.bytes;
+			this->encodedorder.erase(i->second.lastused);
+			i->second.lastused = this->encodedclock++;
+			this->encodedorder.insert(std::make_pair(i->second.lastused, i->first));
+			found = true;
 		}
+
+		if (found)
+			this->numencodedhits.first++;
+		else
+			this->numencodedhits.second++;
 	}
+	this->encodedmutex->unlock();
 
+	return found;
+}
+
+void tilecache::keep_encoded(const quadkey &key, mapcontrol::mapstyle style, const void *data, unsigned int size)
+{
+	if (size > this->maxencodedbytes) return;
+
+	// the bytes are copied before the lock, and swapped in under it
+	encodedtile tile;
+	auto begin = static_cast<const unsigned char *>(data);
+	tile.bytes.assign(begin, begin + size);
+
+	this->encodedmutex->lock();
+	{
+		auto k = std::make_pair(key, style);
+		if (this->encoded.find(k) == this->encoded.end()) {
+			while (this->numencodedbytes + size > this->maxencodedbytes && !this->encodedorder.empty()) {
+				auto coldest = this->encoded.find(this->encodedorder.begin()->second);
+				this->numencodedbytes -= coldest->second.bytes.size();
+				this->encoded.erase(coldest);
+				this->encodedorder.erase(this->encodedorder.begin());
+			}
+
+			tile.lastused = this->encodedclock++;
+			this->encodedorder.insert(std::make_pair(tile.lastused, k));
+			auto &kept = this->encoded[k];
+			kept.bytes.swap(tile.bytes);
+			kept.lastused = tile.lastused;
+			this->numencodedbytes += size;
+		}
+	}
+	this->encodedmutex->unlock();
+}
+
+std::pair<unsigned int, unsigned int> tilecache::get_numencodedhits() const
+{
+	this->encodedmutex->lock();
+	auto hits = this->numencodedhits;
+	this->encodedmutex->unlock();
+	return hits;
+}
+
+// must be called with mapmutex locked; what is needed for the key goes to
+// missing, to be asked for by request_missing. An ancestor standing in for the
+// key goes as a fallback, as the key is marked found and not asked for again.
+void tilecache::add_missing(const quadkey &key, int timestamp)
+{
+	auto needed = key;
+#ifndef IMPLEMENT_DOWNLOAD
+	if (this->repos.is_indexed(key.get_lod(), this->tilestyle)) {
+		needed = this->repos.find_available(key, this->tilestyle);
+		if (needed != key) {
+			this->tiletextures.insert(key, nullptr);
+			if (!needed.empty() && this->tiletextures.search(needed, timestamp).first)
+				needed = quadkey::epsilon();
+		}
+	}
+#endif
+
+	if (!needed.empty())
+		this->missing.push_back(std::make_pair(needed, needed != key));
+}
+
+// must be called with mapmutex locked; the workers are woken once for all of missing
+void tilecache::request_missing(int timestamp, bool prefetched)
+{
+	if (this->missing.empty()) return;
+
+	unsigned int numenqueued = 0;
+	this->lock_measured(*this->quemutex);
+	{
+		for (auto i = this->missing.begin(); i != this->missing.end(); ++i) {
+			if (this->loading.find(i->first) != this->loading.end()) continue;
+			this->enqueue(i->first, timestamp, prefetched, i->second);
+			numenqueued++;
+		}
+
+		if (numenqueued == 1)
+			this->quecond->signal();
+		else if (numenqueued > 1)
+			this->quecond->broadcast();
+	}
 	this->quemutex->unlock();
+
+	this->missing.clear();
 }
 
-void tilecache::insert_tile(const quadkey &key, int timestamp, pngtexture *tex)
+void tilecache::enqueue(const quadkey &key, int timestamp, bool prefetched, bool fallback)
 {
-	this->mapmutex->lock();
+	auto found = this->requestindex.find(key);
+	if (found != this->requestindex.end()) {
+		auto &existing = *found->second;
+		bool kept = (prefetched && !existing.prefetched) || (prefetched == existing.prefetched && existing.timestamp >= timestamp);
+		// the request kept becomes a fallback if either of them is one
+		if (kept && (existing.fallback || !fallback)) return;
+		if (kept) {
+			timestamp = existing.timestamp;
+			prefetched = existing.prefetched;
+		}
+		fallback = fallback || existing.fallback;
+		this->requested.erase(found->second);
+	}
+
+	// distance in tiles of the key's LOD between the tile center and the focus
+	auto lod = key.get_lod();
+	double scale = std::pow(2.0, lod - this->focuslod);
+	quadkey::quadkey_t x = 0, y = 0;
+	for (int i = 0; i < lod; ++i) {
+		auto bit2 = key[i];
+		x = (x << 1) | (bit2 & 1);
+		y = (y << 1) | (bit2 >> 1);
+	}
+	double dx = x + 0.5 - this->focus.first * scale;
+	double dy = y + 0.5 - this->focus.second * scale;
+
+	auto lodgap = lod > this->focuslod ? lod - this->focuslod : this->focuslod - lod;
+	auto inserted = this->requested.insert(tilerequest(key, timestamp, prefetched, fallback, this->generation, this->tilestyle, lodgap, dx * dx + dy * dy));
+	this->requestindex[key] = inserted.first;
+}
+
+void tilecache::set_focus(int lod, const pixelpair &center, int timestamp)
+{
+	this->quemutex->lock();
 	{
-		if (this->tiletextures.get_numnodes() >= this->numtileslimit)
-			this->tiletextures.sweep(timestamp);
+		// the requests of the previous frame stay valid until this one is drawn
+		this->focustimestamp = timestamp - 1;
+		this->focuslod = lod;
+		this->focus = std::make_pair(static_cast<double>(center.x) / this->tilesize, static_cast<double>(center.y) / this->tilesize);
+	}
+	this->quemutex->unlock();
+}
 
-		bool update = tex != nullptr;
-		std::unique_ptr<pngtexture_queued> texqd;
+// called by the workers, which leave the tiles for the drawing side to take in,
+// so that they never hold the lock it searches the tiles under
+void tilecache::insert_tile(const quadkey &key, int timestamp, unsigned int generation, pngtexture *tex)
+{
+	this->arrivemutex->lock();
+	{
+		this->arrivals.push_back(arrival(key, timestamp, generation, tex));
 		if (tex)
-			texqd.reset(new pngtexture_queued(this, tex));
-
-		this->tiletextures.insert(key, texqd.release());
-		if (update) {
 			this->dirty = true;
-			if (this->on_tileloaded)
-				this->on_tileloaded();
+	}
+	this->arrivemutex->unlock();
+
+	if (tex && this->on_tileloaded)
+		this->on_tileloaded();
+}
+
+// must be called with mapmutex locked
+void tilecache::receive_tiles()
+{
+	this->lock_measured(*this->arrivemutex);
+	{
+		this->received.swap(this->arrivals);
+	}
+	this->arrivemutex->unlock();
+
+	for (auto i = this->received.begin(); i != this->received.end(); ++i) {
+		if (i->generation != this->generation) {
+			this->numdiscarded++;
+			delete i->tex;
+			continue;
 		}
+
+		// the coldest tiles make room, but none that the frame asking for this one wanted
+		size_t numbytes = i->tex ? i->tex->get_numresidentbytes() : 0;
+		this->tiletextures.evict(this->maxbytes > numbytes ? this->maxbytes - numbytes : 0, i->timestamp);
+
+		std::unique_ptr<pngtexture_queued> texqd;
+		if (i->tex)
+			texqd.reset(new pngtexture_queued(this, i->tex));
+		this->tiletextures.insert(i->key, texqd.release(), i->timestamp, numbytes);
 	}
+
+	if (!this->received.empty()) {
+		this->lock_measured(*this->quemutex);
+		for (auto i = this->received.begin(); i != this->received.end(); ++i) {
+			if (i->generation == this->generation)
+				this->loading.erase(i->key);
+		}
+		this->quemutex->unlock();
+	}
+	this->received.clear();
+}
+
+// must be called with mapmutex locked; a bound texture drawn at timestamp
+// moves to the hot end of the bound ones
+void tilecache::touch_bound(pngtexture_queued *texqd, int timestamp)
+{
+	texqd->drawntimestamp = timestamp;
+	if (texqd == this->boundhottest) return;
+
+	auto numbytes = texqd->tex->get_numboundbytes();
+	if (!numbytes) return;
+
+	this->unlink_bound(texqd);
+	texqd->colder = this->boundhottest;
+	if (this->boundhottest)
+		this->boundhottest->hotter = texqd;
+	else
+		this->boundcoldest = texqd;
+	this->boundhottest = texqd;
+	texqd->numboundbytes = numbytes;
+	this->numboundbytes += numbytes;
+}
+
+void tilecache::unlink_bound(pngtexture_queued *texqd)
+{
+	if (!texqd->numboundbytes) return;
+
+	if (texqd->colder)
+		texqd->colder->hotter = texqd->hotter;
+	else
+		this->boundcoldest = texqd->hotter;
+	if (texqd->hotter)
+		texqd->hotter->colder = texqd->colder;
+	else
+		this->boundhottest = texqd->colder;
+
+	texqd->colder = texqd->hotter = nullptr;
+	this->numboundbytes -= texqd->numboundbytes;
+	texqd->numboundbytes = 0;
+}
+
+// must be called with mapmutex locked; the least recently drawn textures give
+// up their graphics memory, and are bound again from their pixels when they
+// are back on the screen. Those the last frame drew stay, however many.
+void tilecache::unbind_coldest(int timestamp)
+{
+	while (this->numboundbytes > this->maxboundbytes && this->boundcoldest && this->boundcoldest->drawntimestamp < timestamp - 1) {
+		auto victim = this->boundcoldest;
+		this->unlink_bound(victim);
+		victim->tex->unbind();
+	}
+}
+
+// the seconds spent waiting go to lockwait, which mapmutex guards, so it must
+// be either mapmutex or a lock taken under it
+void tilecache::lock_measured(mutex &m)
+{
+	double start = get_seconds();
+	m.lock();
+	this->lockwait.first++;
+	this->lockwait.second += get_seconds() - start;
+}
+
+std::pair<unsigned int, double> tilecache::get_lockwait() const
+{
+	this->mapmutex->lock();
+	auto waited = this->lockwait;
 	this->mapmutex->unlock();
+	return waited;
 }
 
 void tilecache::set_mode(mapcontrol::mapstyle style)
 {
-	this->tilestyle = style;
-	this->clear();
+	this->clear(&style);
 }
 
 mapcontrol::mapstyle tilecache::get_mode() const
@@ -225,33 +709,153 @@ mapcontrol::mapstyle tilecache::get_mode() const
 
 std::pair<mapctrl::quadkey, const pngtexture *> tilecache::get_texture(const quadkey &key, int timestamp)
 {
-	std::pair<mapctrl::quadkey, pngtexture *> result(mapctrl::quadkey::epsilon(), static_cast<pngtexture *>(0));
+	std::pair<mapctrl::quadkey, const pngtexture *> result(quadkey::epsilon(), static_cast<const pngtexture *>(nullptr));
 
-	this->mapmutex->lock();
+	this->lock_measured(*this->mapmutex);
 	{
-		std::pair<bool, std::pair<mapctrl::quadkey, pngtexture_queued *>> pair = this->tiletextures.search(key, timestamp);
-		result.first = pair.second.first;
-		if (pair.second.second)
-			result.second = pair.second.second->get_tex();
+		result = this->find_texture(key, timestamp);
+		this->request_missing(timestamp, false);
+	}
+	this->mapmutex->unlock();
 
-		if (!pair.first) {
-			this->quemutex->lock();
-			{
-				this->requested.insert(std::make_pair(key, timestamp));
-				this->quecond->signal();
+	return result;
+}
+
+// the same as get_texture for every key, but under one lock, and with the
+// missing tiles requested all together
+void tilecache::get_textures(const std::vector<quadkey> &keys, int timestamp, std::vector<std::pair<mapctrl::quadkey, const pngtexture *>> &results)
+{
+	results.clear();
+
+	this->lock_measured(*this->mapmutex);
+	{
+		for (auto i = keys.begin(); i != keys.end(); ++i)
+			results.push_back(this->find_texture(*i, timestamp));
+		this->request_missing(timestamp, false);
+	}
+	this->mapmutex->unlock();
+}
+
+// must be called with mapmutex locked; a missing key goes to missing
+std::pair<mapctrl::quadkey, const pngtexture *> tilecache::find_texture(const quadkey &key, int timestamp)
+{
+	std::pair<bool, std::pair<mapctrl::quadkey, pngtexture_queued *>> pair = this->tiletextures.search(key, timestamp);
+	if (!pair.first)
+		this->add_missing(key, timestamp);
+
+	// a texture waits for upload_textures to bind it, and its closest bound ancestor stands in until then;
+	// the next frame must come for it even when nothing else changes
+	auto found = pair.second;
+	while (found.second && !found.second->get_tex()->is_bound()) {
+		if (std::find(this->uploads.begin(), this->uploads.end(), found.first) == this->uploads.end()) {
+			this->uploads.push_back(found.first);
+			this->set_dirty();
+		}
+
+		if (!found.first.has_upper()) {
+			found.second = nullptr;
+			break;
+		}
+		found = this->tiletextures.search(found.first.upper(), timestamp).second;
+	}
+
+	if (found.second)
+		this->touch_bound(found.second, timestamp);
+	return std::make_pair(found.first, found.second ? found.second->get_tex() : static_cast<const pngtexture *>(nullptr));
+}
+
+// whether nothing more is going to arrive for the tile: it has been loaded, or
+// it is missing and so is every ancestor up to the one drawn in its place
+bool tilecache::is_resolved(const quadkey &key, int timestamp)
+{
+	bool resolved = false;
+
+	this->lock_measured(*this->mapmutex);
+	{
+		this->receive_tiles();
+
+		auto pair = this->tiletextures.search(key, timestamp);
+		auto drawn = pair.second.first;
+		resolved = pair.first;
+
+		if (resolved && drawn != key) {
+			auto current = key;
+#ifndef IMPLEMENT_DOWNLOAD
+			// the index skips the ancestors that do not exist
+			if (this->repos.is_indexed(key.get_lod(), this->tilestyle)) {
+				current = this->repos.find_available(key, this->tilestyle);
+				resolved = current.empty() || this->tiletextures.search(current, timestamp).first;
+			}
+#endif
+			while (resolved && current != drawn && current.has_upper()) {
+				current = current.upper();
+				resolved = this->tiletextures.search(current, timestamp).first;
 			}
-			this->quemutex->unlock();
 		}
+	}
+	this->mapmutex->unlock();
 
-		{
-			auto texture = result.second;
-			if (texture && !texture->is_bound())
-				texture->bind();
+	return resolved;
+}
+
+unsigned int tilecache::upload_textures(int timestamp, unsigned int maxbytes, float maxseconds)
+{
+	unsigned int numuploaded = 0;
+
+	this->lock_measured(*this->mapmutex);
+	{
+		this->receive_tiles();
+		this->uploadtimer->start(maxseconds);
+
+		// at least one texture goes up every frame, however large
+		unsigned int numbytes = 0;
+		auto i = this->uploads.begin();
+		for ( ; i != this->uploads.end(); ++i) {
+			if (numuploaded && (numbytes >= maxbytes || this->uploadtimer->get_elapsed() >= maxseconds))
+				break;
+
+			auto found = this->tiletextures.search(*i, timestamp).second;
+			if (found.first != *i || !found.second) continue;
+
+			auto texture = found.second->get_tex();
+			if (texture->is_bound()) continue;
+
+			numbytes += texture->get_numbytes();
+			texture->bind();
+			this->touch_bound(found.second, timestamp);
+			numuploaded++;
 		}
+		this->unbind_coldest(timestamp);
+
+		// the rest are asked for again if they are still on the screen
+		if (i != this->uploads.end())
+			this->set_dirty();
+		this->uploads.clear();
+
+		this->uploadtimer->stop();
 	}
 	this->mapmutex->unlock();
 
-	return result;
+	return numuploaded;
+}
+
+void tilecache::prefetch(const std::vector<quadkey> &keys, int timestamp)
+{
+	this->lock_measured(*this->mapmutex);
+	{
+		this->quemutex->lock();
+		{
+			this->prefetchtimestamp = timestamp;
+		}
+		this->quemutex->unlock();
+
+		for (auto i = keys.begin(); i != keys.end(); ++i) {
+			if (!this->tiletextures.search(*i, timestamp).first)
+				this->add_missing(*i, timestamp);
+		}
+		this->request_missing(timestamp, true);
+	}
+	this->mapmutex->unlock();
 }
 
 #ifdef IMPLEMENT_DOWNLOAD
@@ -262,6 +866,7 @@ public:
 	String^ Key;
 	mapcontrol::mapstyle Style;
 	int Timestamp;
+	unsigned int Generation;
 	String^ TargetPath;
 };
 
@@ -312,10 +917,10 @@ static void client_OpenReadCompleted(Object^ sender, OpenReadCompletedEventArgs^
 	auto targetpath = arg->TargetPath;
 	auto targetpathu = marshal_as<std::string>(targetpath);
 	std::unique_ptr<pngtexture> tex(pngtexture::load(nullptr, targetpathu));
-	arg->TileCache->insert_tile(key, arg->Timestamp, tex.get() ? tex.release() : nullptr);
+	arg->TileCache->insert_tile(key, arg->Timestamp, arg->Generation, tex.get() ? tex.release() : nullptr);
 }
 
-void tilecache::download(const quadkey &key, mapcontrol::mapstyle style, int timestamp)
+void tilecache::download(const quadkey &key, mapcontrol::mapstyle style, int timestamp, unsigned int generation)
 {
 	auto sourcepath = marshal_as<String^>(this->repos.get_url(key, style));
 	auto sourceuri = gcnew Uri(sourcepath);
@@ -325,6 +930,7 @@ void tilecache::download(const quadkey &key, mapcontrol::mapstyle style, int tim
 	arg->Key = marshal_as<String^>(key.str());
 	arg->Style = style;
 	arg->Timestamp = timestamp;
+	arg->Generation = generation;
 	arg->TargetPath = marshal_as<String^>(this->repos.get_absolutepath(key, style));
 
 	auto client = gcnew WebClient();
@@ -339,7 +945,7 @@ void tilecache::prepare_path(const quadkey &key, mapcontrol::mapstyle style)
 #endif
 
 
-#ifdef USE_OPENGL
+#if defined USE_OPENGL || defined PLATFORM_HEADLESS
 void tilecache::enqueue_useless_texture(pngtexture *tex)
 {
 	this->useless.push_back(std::unique_ptr<pngtexture>(tex));
@@ -348,7 +954,7 @@ void tilecache::enqueue_useless_texture(pngtexture *tex)
 
 void tilecache::destroy_useless_textures()
 {
-#ifdef USE_OPENGL
+#if defined USE_OPENGL || defined PLATFORM_HEADLESS
 	this->mapmutex->lock();
 	{
 		this->useless.clear();
@@ -366,9 +972,26 @@ void tilecache::sweep(int timestamp)
 	this->mapmutex->unlock();
 }
 
+void tilecache::set_dirty()
+{
+	this->arrivemutex->lock();
+	this->dirty = true;
+	this->arrivemutex->unlock();
+}
+
 void tilecache::clear_dirty()
 {
+	this->arrivemutex->lock();
 	this->dirty = false;
+	this->arrivemutex->unlock();
+}
+
+bool tilecache::is_dirty() const
+{
+	this->arrivemutex->lock();
+	bool result = this->dirty;
+	this->arrivemutex->unlock();
+	return result;
 }
 
 #ifdef LOGGING_QUADTRIE
@@ -378,18 +1001,36 @@ void tilecache::dump_trie(int timestamp) const
 }
 #endif
 
-void tilecache::clear()
+void tilecache::clear(const mapcontrol::mapstyle *style)
 {
-	this->quemutex->lock();
-	{
-		decltype(this->requested) newqueue;
-		this->requested.swap(newqueue);
-	}
-	this->quemutex->unlock();
-
 	this->mapmutex->lock();
 	{
+		this->quemutex->lock();
+		{
+			this->numskipped += static_cast<unsigned int>(this->requested.size());
+
+			decltype(this->requested) newqueue;
+			this->requested.swap(newqueue);
+			this->requestindex.clear();
+			this->loading.clear();
+
+			if (style)
+				this->tilestyle = *style;
+			this->generation++;
+		}
+		this->quemutex->unlock();
+
 		this->tiletextures.clear();
+		this->uploads.clear();
 	}
 	this->mapmutex->unlock();
+
+#ifdef LOGGING
+	logger::info("cancelled requests", this->numskipped, "discarded tiles", this->numdiscarded);
+	logger::info("locks taken for drawing", this->lockwait.first, "seconds waited", this->lockwait.second);
+#ifdef USE_OPENGL
+	auto allocations = this->atlas->get_numallocations();
+	logger::info("reused texture slots", allocations.first, "created texture pages", allocations.second);
+#endif
+#endif
 }
@@ -16,6 +16,35 @@
 
 #pragma once
 
+class tilearchive
+{
+public:
+	static tilearchive * open(const std::string &abspath, int lod);
+
+	bool contains(const mapctrl::quadkey &key) const;
+	std::pair<const void *, unsigned int> find(const mapctrl::quadkey &key) const;
+
+	unsigned int get_numentries() const
+	{
+		return this->numentries;
+	}
+
+	bool is_indexonly() const
+	{
+		return this->keys != nullptr;
+	}
+
+private:
+	std::unique_ptr<mappedfile> mapped;
+	const archive::entry *entries;
+	const archive::uint64 *keys;
+	unsigned int numentries;
+
+	tilearchive(mappedfile *mapped);
+	tilearchive(const tilearchive &r);
+	tilearchive & operator=(const tilearchive &r);
+};
+
 class repository
 {
 public:
@@ -23,61 +52,172 @@ public:
 
 	bool exists(const mapctrl::quadkey &key, mapctrl::mapcontrol::mapstyle style) const;
 	std::string get_absolutepath(const mapctrl::quadkey &key, mapctrl::mapcontrol::mapstyle style) const;
+	bool is_packed(int lod, mapctrl::mapcontrol::mapstyle style) const;
+	bool is_indexed(int lod, mapctrl::mapcontrol::mapstyle style) const;
+	mapctrl::quadkey find_available(const mapctrl::quadkey &key, mapctrl::mapcontrol::mapstyle style) const;
+	std::pair<const void *, unsigned int> get_packed(const mapctrl::quadkey &key, mapctrl::mapcontrol::mapstyle style) const;
 #ifdef IMPLEMENT_DOWNLOAD
 	std::string get_url(const mapctrl::quadkey &key, mapctrl::mapcontrol::mapstyle style) const;
 	bool prepare_path(const mapctrl::quadkey &key, mapctrl::mapcontrol::mapstyle style) const;
 #endif
 
+	static char get_stylecode(mapctrl::mapcontrol::mapstyle style);
+
 private:
+	static const int MAXLOD = 24;
+
 	const std::string tilerootdir;
 	const unsigned int combinefactor;
+	std::unique_ptr<tilearchive> roadarchives[MAXLOD];
+	std::unique_ptr<tilearchive> hybridarchives[MAXLOD];
 
 	std::string get_relativepath(const mapctrl::quadkey &key, mapctrl::mapcontrol::mapstyle style) const;
+	void open_archives(const std::string &rootdir, mapctrl::mapcontrol::mapstyle style, std::unique_ptr<tilearchive> *archives);
+	const tilearchive * get_archive(int lod, mapctrl::mapcontrol::mapstyle style) const;
 };
 
-template<typename T>
+// where quadtrie gets the memory of its nodes from: one by one from the heap,
+template<typename Node>
+class heapnodes
+{
+public:
+	void * allocate()
+	{
+		return ::operator new(sizeof(Node));
+	}
+
+	void release(void *p)
+	{
+		::operator delete(p);
+	}
+};
+
+// or from slabs of nodes that stay with the trie, where released nodes are
+// kept on a free list for the next ones
+template<typename Node>
+class poolednodes
+{
+public:
+	poolednodes()
+		: freelist(nullptr)
+	{
+	}
+
+	void * allocate()
+	{
+		if (!this->freelist)
+			this->grow();
+
+		auto allocated = this->freelist;
+		this->freelist = allocated->next;
+		return allocated;
+	}
+
+	void release(void *p)
+	{
+		auto released = static_cast<slot *>(p);
+		released->next = this->freelist;
+		this->freelist = released;
+	}
+
+	unsigned int get_numslabs() const
+	{
+		return static_cast<unsigned int>(this->slabs.size());
+	}
+
+private:
+	static const unsigned int NUMSLOTSPERSLAB = 256;
+
+	union slot
+	{
+		slot *next;
+		typename std::aligned_storage<sizeof(Node), std::alignment_of<Node>::value>::type storage;
+	};
+
+	std::vector<std::unique_ptr<slot[]>> slabs;
+	slot *freelist;
+
+	void grow()
+	{
+		std::unique_ptr<slot[]> slab(new slot[NUMSLOTSPERSLAB]);
+		for (unsigned int i = 0; i < NUMSLOTSPERSLAB; ++i)
+			slab[i].next = i + 1 < NUMSLOTSPERSLAB ? &slab[i + 1] : this->freelist;
+		this->freelist = &slab[0];
+		this->slabs.push_back(std::move(slab));
+	}
+};
+
+template<typename T, template<typename> class NodeAllocator = poolednodes>
 class quadtrie
 {
 public:
+	class node;
+	typedef NodeAllocator<node> allocator;
+
+	struct nodedeleter
+	{
+		void operator()(node *n) const
+		{
+			quadtrie::destroy_node(n);
+		}
+	};
+	typedef std::unique_ptr<node, nodedeleter> nodeptr;
+
 	class node
 	{
-		node(const mapctrl::quadkey &path)
-			: path(path), data(std::make_pair(false, std::unique_ptr<T>(nullptr))), accesstimestamp(std::make_pair(0, 0))
+		node(allocator *nodes, const mapctrl::quadkey &path)
+			: nodes(nodes), path(path), key(mapctrl::quadkey::epsilon()), data(std::make_pair(false, std::unique_ptr<T>(nullptr))), accesstimestamp(std::make_pair(0, 0)), numbytes(0), colder(nullptr), hotter(nullptr)
 		{
 		}
 
-		node(const mapctrl::quadkey &path, T *data, int firstaccess)
-			: path(path), data(std::make_pair(true, data)), accesstimestamp(std::make_pair(firstaccess, 0))
+		node(allocator *nodes, const mapctrl::quadkey &path, const mapctrl::quadkey &key, T *data, int firstaccess, size_t numbytes)
+			: nodes(nodes), path(path), key(key), data(std::make_pair(true, data)), accesstimestamp(std::make_pair(firstaccess, firstaccess)), numbytes(numbytes), colder(nullptr), hotter(nullptr)
 		{
 		}
     
 	private:
+		allocator *nodes;
 		mapctrl::quadkey path;
+		// the whole key, which the path compression leaves alone
+		mapctrl::quadkey key;
 		std::pair<bool, std::unique_ptr<T>> data;
 		std::pair<int, int> accesstimestamp;
-		std::unique_ptr<node> children[4];
+		// what the data costs the trie, the node itself included; nothing for path nodes
+		size_t numbytes;
+		nodeptr children[4];
+		// the neighbours among the nodes holding data, ordered by their last search
+		node *colder;
+		node *hotter;
 
 		friend class quadtrie;
 	};
 
 public:
 	quadtrie()
-		: root(new node(mapctrl::quadkey::epsilon())), numdatanodes(0)
+		: nodes(new allocator()), root(nullptr), numdatanodes(0), numbytes(0), coldest(nullptr), hottest(nullptr)
 	{
+		this->root = this->create_node(mapctrl::quadkey::epsilon());
 	}
 
 	~quadtrie()
 	{
-		delete this->root;
+		destroy_node(this->root);
 	}
 
-	void insert(const mapctrl::quadkey &key, T *data, int firstaccess = 0)
+	const allocator & get_allocator() const
+	{
+		return *this->nodes;
+	}
+
+	// a firstaccess other than 0 counts as a search at that time; numbytes is the
+	// memory data holds on to, which counts against the budget of evict()
+	void insert(const mapctrl::quadkey &key, T *data, int firstaccess = 0, size_t numbytes = 0)
 	{
 #ifdef LOGGING_QUADTRIE
 		//this->dump(0);
 		//logger::info("inserting", key.str());
 #endif
-		this->insert(key, data, firstaccess, this->root);
+		this->insert(key, key, data, firstaccess, sizeof(node) + numbytes, this->root);
 #ifdef LOGGING_QUADTRIE
 		//this->dump(0);
 #endif
@@ -87,9 +227,11 @@ public:
 
 	bool remove(const mapctrl::quadkey &key)
 	{
-		if (!this->remove(key, nullptr, this->root)) return false;
+		std::unique_ptr<T> removed;
+		if (!this->remove(key, nullptr, this->root, removed)) return false;
 
-		this->numdatanodes--;
+		if (removed.get())
+			this->numdatanodes--;
 		return true;
 	}
 
@@ -101,9 +243,7 @@ public:
 		if (!best.second)
 			return std::make_pair(exactdatanode, std::make_pair(best.first, static_cast<T *>(nullptr)));
 
-		best.second->accesstimestamp.second = timestamp;
-		if (!best.second->accesstimestamp.first)
-			best.second->accesstimestamp.first = timestamp;
+		this->touch(best.second, timestamp);
 		return std::make_pair(exactdatanode, std::make_pair(best.first, best.second->data.second.get()));
 	}
 
@@ -112,34 +252,48 @@ public:
 		return this->numdatanodes;
 	}
 
+	size_t get_numbytes() const
+	{
+		return this->numbytes;
+	}
+
+	// removes the data not searched for since timestamp in place, coldest first,
+	// so that it costs in proportion to what goes rather than to what stays
 	void sweep(int timestamp)
 	{
 #ifdef LOGGING_QUADTRIE
 		int prevcount = this->dump(timestamp);
 #endif
 
-		quadtrie newtrie;
-		this->sweep(timestamp, newtrie, mapctrl::quadkey::epsilon(), this->root);
+		while (this->coldest && this->coldest->accesstimestamp.second < timestamp) {
+			auto victim = this->coldest->key;
+			if (!this->remove(victim)) break;
+		}
 
 #ifdef LOGGING_QUADTRIE
-		int newcount = newtrie.dump(timestamp);
+		int newcount = this->dump(timestamp);
 		logger::info("sweep at ", timestamp, prevcount, newcount);
 #endif
+	}
 
-		delete this->root;
-
-		this->root = newtrie.root;
-		this->numdatanodes = newtrie.numdatanodes;
-
-		newtrie.root = nullptr;
+	// removes the coldest data until the rest takes no more than maxbytes, but
+	// leaves alone what has been searched for since timestamp
+	void evict(size_t maxbytes, int timestamp)
+	{
+		while (this->numbytes > maxbytes && this->coldest && this->coldest->accesstimestamp.second < timestamp) {
+			auto victim = this->coldest->key;
+			if (!this->remove(victim)) break;
+		}
 	}
 
 	void clear()
 	{
-		delete this->root;
+		destroy_node(this->root);
 
-		this->root = new node(mapctrl::quadkey::epsilon());
+		this->root = this->create_node(mapctrl::quadkey::epsilon());
 		this->numdatanodes = 0;
+		this->numbytes = 0;
+		this->coldest = this->hottest = nullptr;
 	}
 
 #ifdef LOGGING_QUADTRIE
@@ -154,10 +308,91 @@ public:
 #endif
 
 private:
+	std::unique_ptr<allocator> nodes;
 	node *root;
 	unsigned int numdatanodes;
+	size_t numbytes;
+	node *coldest;
+	node *hottest;
+
+	node * create_node(const mapctrl::quadkey &path)
+	{
+		return new (this->nodes->allocate()) node(this->nodes.get(), path);
+	}
+
+	node * create_node(const mapctrl::quadkey &path, const mapctrl::quadkey &key, T *data, int firstaccess, size_t numbytes)
+	{
+		auto created = new (this->nodes->allocate()) node(this->nodes.get(), path, key, data, firstaccess, numbytes);
+		this->link_inserted(created);
+		this->numbytes += numbytes;
+		return created;
+	}
+
+	static void destroy_node(node *n)
+	{
+		if (!n) return;
 
-	void insert(const mapctrl::quadkey &key, T *data, int firstaccess, node *parent)
+		auto nodes = n->nodes;
+		n->~node();
+		nodes->release(n);
+	}
+
+	void link_coldest(node *n)
+	{
+		n->colder = nullptr;
+		n->hotter = this->coldest;
+		if (this->coldest)
+			this->coldest->colder = n;
+		else
+			this->hottest = n;
+		this->coldest = n;
+	}
+
+	void link_hottest(node *n)
+	{
+		n->hotter = nullptr;
+		n->colder = this->hottest;
+		if (this->hottest)
+			this->hottest->hotter = n;
+		else
+			this->coldest = n;
+		this->hottest = n;
+	}
+
+	// data nodes that have not been searched for yet start at the cold end
+	void link_inserted(node *n)
+	{
+		if (n->accesstimestamp.second)
+			this->link_hottest(n);
+		else
+			this->link_coldest(n);
+	}
+
+	void touch(node *n, int timestamp)
+	{
+		n->accesstimestamp.second = timestamp;
+		if (!n->accesstimestamp.first)
+			n->accesstimestamp.first = timestamp;
+		if (n != this->hottest) {
+			this->unlink(n);
+			this->link_hottest(n);
+		}
+	}
+
+	void unlink(node *n)
+	{
+		if (n->colder)
+			n->colder->hotter = n->hotter;
+		else
+			this->coldest = n->hotter;
+		if (n->hotter)
+			n->hotter->colder = n->colder;
+		else
+			this->hottest = n->colder;
+		n->colder = n->hotter = nullptr;
+	}
+
+	void insert(const mapctrl::quadkey &key, const mapctrl::quadkey &abskey, T *data, int firstaccess, size_t numbytes, node *parent)
 	{
 		auto &child = parent->children[key.prefix()];
 		if (child.get()) {
@@ -165,29 +400,41 @@ private:
 			auto subchild = child->path.suffix(commonkey);
 			auto subadding = key.suffix(commonkey);
 
-			if (subchild.empty() && subadding.empty())
+			if (subchild.empty() && subadding.empty()) {
+				if (child->data.second.get())
+					this->numdatanodes--;
+				if (!child->data.first) {
+					child->key = abskey;
+					child->accesstimestamp = std::make_pair(firstaccess, firstaccess);
+					this->link_inserted(child.get());
+				}
+				else if (firstaccess)
+					this->touch(child.get(), firstaccess);
 				child->data = std::make_pair(true, std::unique_ptr<T>(data));
+				this->numbytes += numbytes - child->numbytes;
+				child->numbytes = numbytes;
+			}
 			else if (subchild.empty())
-				this->insert(subadding, data, firstaccess, child.get());
+				this->insert(subadding, abskey, data, firstaccess, numbytes, child.get());
 			else if (subadding.empty()) {
-				auto adding = new node(key, data, firstaccess);
+				auto adding = this->create_node(key, abskey, data, firstaccess, numbytes);
 				auto childnode = child.release();
 				child.reset(adding);
 				childnode->path = subchild;
 				adding->children[subchild.prefix()].reset(childnode);
 			}
 			else {
-				auto pivot = new node(commonkey);
+				auto pivot = this->create_node(commonkey);
 				auto childnode = child.release();
 				child.reset(pivot);
 				childnode->path = subchild;
-				auto adding = new node(subadding, data, firstaccess);
+				auto adding = this->create_node(subadding, abskey, data, firstaccess, numbytes);
 				pivot->children[subchild.prefix()].reset(childnode);
 				pivot->children[subadding.prefix()].reset(adding);
 			}
 		}
 		else {
-			auto adding = new node(key, data, firstaccess);
+			auto adding = this->create_node(key, abskey, data, firstaccess, numbytes);
 			child.reset(adding);
 		}
 	}
@@ -211,7 +458,9 @@ private:
 		return nothing;
 	}
 
-	bool remove(const mapctrl::quadkey &key, node *grandparent, node *parent)
+	// takes the data out of the node, and then the node out of the trie unless it
+	// still has children to lead to; removed receives what the node held
+	bool remove(const mapctrl::quadkey &key, node *grandparent, node *parent, std::unique_ptr<T> &removed)
 	{
 		auto &child = parent->children[key.prefix()];
 		if (!child.get()) return false;
@@ -220,12 +469,20 @@ private:
 		auto subchild = child->path.suffix(commonkey);
 		auto subvictim = key.suffix(commonkey);
 		if (subchild.empty() && subvictim.empty()) {
-			bool dataremoved = child->data.get() != nullptr;
-			child->data.reset(nullptr);
+			if (!child->data.first) return false;
+
+			this->unlink(child.get());
+			removed.reset(child->data.second.release());
+			child->data.first = false;
+			child->accesstimestamp = std::make_pair(0, 0);
+			this->numbytes -= child->numbytes;
+			child->numbytes = 0;
+
 			int singlegrandchildindex;
 			if (this->get_singlechild(child.get(), &singlegrandchildindex)) {
 				child.reset(nullptr);
-				if (!parent->data.get() && grandparent) {
+				// a parent left with a single child is only a path now, and merges into it
+				if (!parent->data.first && grandparent) {
 					int singlesiblingindex;
 					this->get_singlechild(parent, &singlesiblingindex);
 					if (singlesiblingindex != -1) {
@@ -240,12 +497,12 @@ private:
 				singlegrandchild->path = child->path.concat(singlegrandchild->path);
 				child.reset(singlegrandchild.release());
 			}
-			return dataremoved;
+			return true;
 		}
 		else if (subchild.get_lod() > subvictim.get_lod())
 			return false;
 		else if (subchild.empty())
-			return this->remove(subvictim, parent, child.get());
+			return this->remove(subvictim, parent, child.get(), removed);
 		return false;
 	}
 
@@ -272,22 +529,6 @@ private:
 		return false;
 	}
 
-	void sweep(int timestamp, quadtrie &newtrie, mapctrl::quadkey abspath, node *parent)
-	{
-		auto path = abspath.concat(parent->path);
-
-		if (parent->data.second.get()) {
-			if (parent->accesstimestamp.second >= timestamp)
-				newtrie.insert(path, parent->data.second.release(), parent->accesstimestamp.first);
-		}
-
-		for (int i = 0; i < 4; ++i) {
-			auto &child = parent->children[i];
-			if (child.get())
-				this->sweep(timestamp, newtrie, path, child.get());
-		}
-	}
-
 #ifdef LOGGING_QUADTRIE
 	void dump(int timestamp, mapctrl::quadkey parentabspath, const node *n, int level, int &count) const
 	{
@@ -322,11 +563,360 @@ private:
 #endif
 };
 
+// The same as quadtrie, but kept in an open addressing table of whole keys
+// rather than in a tree of nodes. A key that is not there falls back to its
+// ancestors one level at a time, skipping the levels that hold no data.
+template<typename T>
+class quadtable
+{
+public:
+	quadtable()
+		: numbits(0), numentries(0), numdatanodes(0), numbytes(0), coldest(NIL), hottest(NIL)
+	{
+		this->reset(MINNUMBITS);
+	}
+
+	// a firstaccess other than 0 counts as a search at that time; numbytes is the
+	// memory data holds on to, which counts against the budget of evict()
+	void insert(const mapctrl::quadkey &key, T *data, int firstaccess = 0, size_t numbytes = 0)
+	{
+		std::unique_ptr<T> adding(data);
+		auto packed = pack(key);
+
+		int index = this->probe(packed);
+		if (!this->slots[index].packed) {
+			if ((this->numentries + 1) * 2 > this->slots.size()) {
+				this->grow();
+				index = this->probe(packed);
+			}
+
+			auto &added = this->slots[index];
+			added.packed = packed;
+			added.accesstimestamp = std::make_pair(firstaccess, firstaccess);
+			added.numbytes = 0;
+			this->numentries++;
+			if (firstaccess)
+				this->link_hottest(index);
+			else
+				this->link_coldest(index);
+		}
+		else {
+			if (this->slots[index].data.get())
+				this->forget_data(key);
+			if (firstaccess)
+				this->touch(index, firstaccess);
+		}
+
+		auto &s = this->slots[index];
+		this->numbytes += sizeof(slot) + numbytes - s.numbytes;
+		s.numbytes = sizeof(slot) + numbytes;
+		s.data.reset(adding.release());
+		if (s.data.get()) {
+			this->numdatanodes++;
+			this->numperlod[key.get_lod()]++;
+		}
+	}
+
+	bool remove(const mapctrl::quadkey &key)
+	{
+		int index = this->probe(pack(key));
+		if (!this->slots[index].packed) return false;
+
+		this->remove_at(index);
+		return true;
+	}
+
+	std::pair<bool, std::pair<mapctrl::quadkey, T *>> search(const mapctrl::quadkey &key, int timestamp)
+	{
+		int index = this->probe(pack(key));
+		bool exactdatanode = this->slots[index].packed != 0;
+
+		int best = exactdatanode && this->slots[index].data.get() ? index : NIL;
+		auto bestkey = key;
+		while (best == NIL && bestkey.has_upper()) {
+			bestkey = bestkey.upper();
+			if (!this->numperlod[bestkey.get_lod()]) continue;
+
+			index = this->probe(pack(bestkey));
+			if (this->slots[index].data.get())
+				best = index;
+		}
+
+		if (best == NIL)
+			return std::make_pair(exactdatanode, std::make_pair(mapctrl::quadkey::epsilon(), static_cast<T *>(nullptr)));
+
+		this->touch(best, timestamp);
+		return std::make_pair(exactdatanode, std::make_pair(bestkey, this->slots[best].data.get()));
+	}
+
+	unsigned int get_numnodes() const
+	{
+		return this->numdatanodes;
+	}
+
+	size_t get_numbytes() const
+	{
+		return this->numbytes;
+	}
+
+	// removes the data not searched for since timestamp, coldest first
+	void sweep(int timestamp)
+	{
+		while (this->coldest != NIL && this->slots[this->coldest].accesstimestamp.second < timestamp)
+			this->remove_at(this->coldest);
+	}
+
+	// removes the coldest data until the rest takes no more than maxbytes, but
+	// leaves alone what has been searched for since timestamp
+	void evict(size_t maxbytes, int timestamp)
+	{
+		while (this->numbytes > maxbytes && this->coldest != NIL && this->slots[this->coldest].accesstimestamp.second < timestamp)
+			this->remove_at(this->coldest);
+	}
+
+	void clear()
+	{
+		this->reset(MINNUMBITS);
+	}
+
+#ifdef LOGGING_QUADTRIE
+	int dump(int timestamp) const
+	{
+		logger::info(" === DUMP === ", timestamp);
+		int count = 0;
+		for (int i = this->hottest; i != NIL; i = this->slots[i].colder, ++count) {
+			auto &s = this->slots[i];
+			std::ostringstream line;
+			line << (timestamp == s.accesstimestamp.second ? "-- " : "   ") << unpack(s.packed).str() << " : ";
+			if (s.data.get())
+				line << "O [" << s.accesstimestamp.first << " ~ " << s.accesstimestamp.second << "]";
+			else
+				line << 'X';
+			logger::info(line.str());
+		}
+		logger::info(" # nodes", count);
+		return count;
+	}
+#endif
+
+private:
+	static const int NIL = -1;
+	static const unsigned int MINNUMBITS = 8;
+	// the level is packed below the key, so that keys of different levels differ
+	static const unsigned int LODBITS = 5;
+
+	struct slot
+	{
+		slot()
+			: packed(0), accesstimestamp(std::make_pair(0, 0)), numbytes(0), colder(NIL), hotter(NIL)
+		{
+		}
+
+		slot(slot &&r)
+			: packed(r.packed), data(std::move(r.data)), accesstimestamp(r.accesstimestamp), numbytes(r.numbytes), colder(r.colder), hotter(r.hotter)
+		{
+		}
+
+		slot & operator=(slot &&r)
+		{
+			this->packed = r.packed;
+			this->data = std::move(r.data);
+			this->accesstimestamp = r.accesstimestamp;
+			this->numbytes = r.numbytes;
+			this->colder = r.colder;
+			this->hotter = r.hotter;
+			return *this;
+		}
+
+		// 0 for an empty slot, which the root key never takes
+		unsigned long long packed;
+		std::unique_ptr<T> data;
+		std::pair<int, int> accesstimestamp;
+		size_t numbytes;
+		// the neighbours among the keys, ordered by their last search
+		int colder;
+		int hotter;
+
+	private:
+		slot(const slot &r);
+		slot & operator=(const slot &r);
+	};
+
+	std::vector<slot> slots;
+	unsigned int numbits;
+	unsigned int numentries;
+	unsigned int numdatanodes;
+	size_t numbytes;
+	// how many keys of every level hold data
+	unsigned int numperlod[1 << LODBITS];
+	int coldest;
+	int hottest;
+
+	static unsigned long long pack(const mapctrl::quadkey &key)
+	{
+		return static_cast<unsigned long long>(key.get_key()) << LODBITS | key.get_lod();
+	}
+
+	static mapctrl::quadkey unpack(unsigned long long packed)
+	{
+		return mapctrl::quadkey(static_cast<mapctrl::quadkey::quadkey_t>(packed >> LODBITS), static_cast<unsigned int>(packed & ((1 << LODBITS) - 1)));
+	}
+
+	int get_home(unsigned long long packed) const
+	{
+		return static_cast<int>((packed * 0x9e3779b97f4a7c15ULL) >> (64 - this->numbits));
+	}
+
+	int get_mask() const
+	{
+		return static_cast<int>(this->slots.size()) - 1;
+	}
+
+	// the slot holding packed, or else the empty slot ending its probe sequence
+	int probe(unsigned long long packed) const
+	{
+		int mask = this->get_mask();
+		int index = this->get_home(packed);
+		while (this->slots[index].packed && this->slots[index].packed != packed)
+			index = (index + 1) & mask;
+		return index;
+	}
+
+	void reset(unsigned int numbits)
+	{
+		std::vector<slot> emptied(static_cast<size_t>(1) << numbits);
+		this->slots.swap(emptied);
+		this->numbits = numbits;
+		this->numentries = this->numdatanodes = 0;
+		this->numbytes = 0;
+		std::fill(this->numperlod, this->numperlod + (1 << LODBITS), 0U);
+		this->coldest = this->hottest = NIL;
+	}
+
+	// moves every key into a table twice as large, keeping their order
+	void grow()
+	{
+		std::vector<slot> old(static_cast<size_t>(1) << (this->numbits + 1));
+		old.swap(this->slots);
+		this->numbits++;
+
+		int from = this->coldest;
+		this->coldest = this->hottest = NIL;
+		while (from != NIL) {
+			int next = old[from].hotter;
+			int to = this->probe(old[from].packed);
+			this->slots[to] = std::move(old[from]);
+			this->link_hottest(to);
+			from = next;
+		}
+	}
+
+	void forget_data(const mapctrl::quadkey &key)
+	{
+		this->numdatanodes--;
+		this->numperlod[key.get_lod()]--;
+	}
+
+	void remove_at(int index)
+	{
+		auto &removed = this->slots[index];
+		if (removed.data.get())
+			this->forget_data(unpack(removed.packed));
+		this->numbytes -= removed.numbytes;
+		this->numentries--;
+		this->unlink(index);
+		removed.packed = 0;
+		removed.data.reset(nullptr);
+
+		// the keys after the hole move back into it, unless it comes before their home
+		int mask = this->get_mask();
+		int hole = index;
+		for (int i = (hole + 1) & mask; this->slots[i].packed; i = (i + 1) & mask) {
+			int home = this->get_home(this->slots[i].packed);
+			if (((i - home) & mask) >= ((i - hole) & mask)) {
+				this->move_slot(i, hole);
+				hole = i;
+			}
+		}
+	}
+
+	void move_slot(int from, int to)
+	{
+		auto &moved = this->slots[to];
+		moved = std::move(this->slots[from]);
+		this->slots[from].packed = 0;
+
+		if (moved.colder != NIL)
+			this->slots[moved.colder].hotter = to;
+		else
+			this->coldest = to;
+		if (moved.hotter != NIL)
+			this->slots[moved.hotter].colder = to;
+		else
+			this->hottest = to;
+	}
+
+	void link_coldest(int index)
+	{
+		auto &s = this->slots[index];
+		s.colder = NIL;
+		s.hotter = this->coldest;
+		if (this->coldest != NIL)
+			this->slots[this->coldest].colder = index;
+		else
+			this->hottest = index;
+		this->coldest = index;
+	}
+
+	void link_hottest(int index)
+	{
+		auto &s = this->slots[index];
+		s.hotter = NIL;
+		s.colder = this->hottest;
+		if (this->hottest != NIL)
+			this->slots[this->hottest].hotter = index;
+		else
+			this->coldest = index;
+		this->hottest = index;
+	}
+
+	void touch(int index, int timestamp)
+	{
+		auto &s = this->slots[index];
+		s.accesstimestamp.second = timestamp;
+		if (!s.accesstimestamp.first)
+			s.accesstimestamp.first = timestamp;
+		if (index != this->hottest) {
+			this->unlink(index);
+			this->link_hottest(index);
+		}
+	}
+
+	void unlink(int index)
+	{
+		auto &s = this->slots[index];
+		if (s.colder != NIL)
+			this->slots[s.colder].hotter = s.hotter;
+		else
+			this->coldest = s.hotter;
+		if (s.hotter != NIL)
+			this->slots[s.hotter].colder = s.colder;
+		else
+			this->hottest = s.colder;
+		s.colder = s.hotter = NIL;
+	}
+
+	quadtable(const quadtable &r);
+	quadtable & operator=(const quadtable &r);
+};
+
 class pngtexture_queued
 {
+	friend class tilecache;
+
 public:
 	pngtexture_queued(tilecache *enclosing, pngtexture *tex)
-		: enclosing(enclosing), tex(tex)
+		: enclosing(enclosing), tex(tex), colder(nullptr), hotter(nullptr), numboundbytes(0), drawntimestamp(0)
 	{
 	}
 
@@ -340,64 +930,209 @@ public:
 private:
 	tilecache *enclosing;
 	pngtexture *tex;
+	// the bound textures are listed from the least recently drawn, apart from
+	// the index, so that they can give up the graphics memory and keep the pixels
+	pngtexture_queued *colder;
+	pngtexture_queued *hotter;
+	unsigned int numboundbytes;
+	int drawntimestamp;
 };
 
 class tilecache
 {
+	friend class pngtexture_queued;
+
 public:
 	typedef void (*tileloadedhandler)();
 
-	tilecache(const std::string &rootdir, unsigned int tilesize, unsigned int numtileslimit);
+	// maxbytes bounds the memory of the cached tiles, and maxboundbytes the
+	// part of them that is bound in the graphics system as well;
+	// maxencodedbytes bounds the files kept as read, to be decoded again
+	// without reading them; numworkers of 0 starts one decoding thread per core
+	tilecache(const std::string &rootdir, unsigned int tilesize, size_t maxbytes, size_t maxboundbytes, size_t maxencodedbytes, unsigned int numworkers = 0);
 	~tilecache();
 
 	bool initialize(tileloadedhandler handler);
 	void work();
 
-	void insert_tile(const mapctrl::quadkey &key, int timestamp, pngtexture *tex);
+	void insert_tile(const mapctrl::quadkey &key, int timestamp, unsigned int generation, pngtexture *tex);
+	void set_focus(int lod, const mapctrl::pixelpair &center, int timestamp);
 
 	void set_mode(mapctrl::mapcontrol::mapstyle style);
 	mapctrl::mapcontrol::mapstyle get_mode() const;
 
 	std::pair<mapctrl::quadkey, const pngtexture *> get_texture(const mapctrl::quadkey &key, int timestamp);
+	void get_textures(const std::vector<mapctrl::quadkey> &keys, int timestamp, std::vector<std::pair<mapctrl::quadkey, const pngtexture *>> &results);
+	bool is_resolved(const mapctrl::quadkey &key, int timestamp);
+	unsigned int upload_textures(int timestamp, unsigned int maxbytes, float maxseconds);
+	void prefetch(const std::vector<mapctrl::quadkey> &keys, int timestamp);
 #ifdef IMPLEMENT_DOWNLOAD
-	void download(const mapctrl::quadkey &key, mapctrl::mapcontrol::mapstyle style, int timestamp);
+	void download(const mapctrl::quadkey &key, mapctrl::mapcontrol::mapstyle style, int timestamp, unsigned int generation);
 	void prepare_path(const mapctrl::quadkey &key, mapctrl::mapcontrol::mapstyle style);
 #endif
 
-#ifdef USE_OPENGL
+#if defined USE_OPENGL || defined PLATFORM_HEADLESS
 	void enqueue_useless_texture(pngtexture *tex);
+#endif
+#ifdef USE_OPENGL
+	tileatlas * get_atlas()
+	{
+		return this->atlas.get();
+	}
 #endif
 	void destroy_useless_textures();
 
 	void sweep(int timestamp);
 
 	void clear_dirty();
-	bool is_dirty() const
+	bool is_dirty() const;
+
+	// requests dropped before decoding, and decoded tiles thrown away
+	std::pair<unsigned int, unsigned int> get_numcancelled() const
 	{
-		return this->dirty;
+		return std::make_pair(this->numskipped, this->numdiscarded);
 	}
 
+	// how many tiles were decoded from the kept files, and how many had to be read
+	std::pair<unsigned int, unsigned int> get_numencodedhits() const;
+
+	// how many locks the drawing side has taken, and the seconds it spent waiting for them
+	std::pair<unsigned int, double> get_lockwait() const;
+
 #ifdef LOGGING_QUADTRIE
 	void dump_trie(int timestamp) const;
 #endif
 
 private:
+	// requests are ordered so that the tiles on the screen go before the
+	// prefetched ones, then the most recent frame goes first, then the
+	// displayed LOD, then the tiles closest to the center of the screen. The
+	// generation changes whenever the cached tiles are thrown away, so that
+	// requests and results from before can be told apart. A fallback request
+	// stands in for a missing tile, which is marked as found, so it is never
+	// asked for again and must not be dropped as stale.
+	struct tilerequest
+	{
+		tilerequest(const mapctrl::quadkey &key, int timestamp, bool prefetched, bool fallback, unsigned int generation, mapctrl::mapcontrol::mapstyle style, int lodgap, double distance)
+			: key(key), timestamp(timestamp), prefetched(prefetched), fallback(fallback), generation(generation), style(style), lodgap(lodgap), distance(distance)
+		{
+		}
+
+		bool operator<(const tilerequest &r) const
+		{
+			if (this->prefetched != r.prefetched) return !this->prefetched;
+			if (this->timestamp != r.timestamp) return this->timestamp > r.timestamp;
+			if (this->lodgap != r.lodgap) return this->lodgap < r.lodgap;
+			if (this->distance != r.distance) return this->distance < r.distance;
+			return this->key < r.key;
+		}
+
+		mapctrl::quadkey key;
+		int timestamp;
+		bool prefetched;
+		bool fallback;
+		unsigned int generation;
+		mapctrl::mapcontrol::mapstyle style;
+		int lodgap;
+		double distance;
+	};
+	typedef std::set<tilerequest> requestqueue;
+
+	// a tile the workers are done with, which the drawing side takes in later
+	struct arrival
+	{
+		arrival(const mapctrl::quadkey &key, int timestamp, unsigned int generation, pngtexture *tex)
+			: key(key), timestamp(timestamp), generation(generation), tex(tex)
+		{
+		}
+
+		mapctrl::quadkey key;
+		int timestamp;
+		unsigned int generation;
+		pngtexture *tex;
+	};
+
+	// a tile file as it was read, and when a worker last loaded it
+	struct encodedtile
+	{
+		std::vector<unsigned char> bytes;
+		unsigned int lastused;
+	};
+	typedef std::pair<mapctrl::quadkey, mapctrl::mapcontrol::mapstyle> encodedkey;
+
 	const repository repos;
 	const unsigned int tilesize;
 	mapctrl::mapcontrol::mapstyle tilestyle;
-	std::unique_ptr<mapctrl::thread> worker;
+	const unsigned int numworkers;
+	std::vector<mapctrl::thread *> workers;
 	bool flagterminate;
 	std::unique_ptr<mapctrl::mutex> mapmutex;
+#ifdef USE_QUADTABLE
+	quadtable<pngtexture_queued> tiletextures;
+#else
 	quadtrie<pngtexture_queued> tiletextures;
-	const unsigned int numtileslimit;
+#endif
+	// decoded tiles the last frame wanted to draw, in the order it asked for them
+	std::vector<mapctrl::quadkey> uploads;
+	// tiles found missing under the current lock, requested before it is
+	// released, each with whether it is a fallback request
+	std::vector<std::pair<mapctrl::quadkey, bool>> missing;
+	std::unique_ptr<mapctrl::progresstimer> uploadtimer;
+	const size_t maxbytes;
+	const size_t maxboundbytes;
+	size_t numboundbytes;
+	pngtexture_queued *boundcoldest;
+	pngtexture_queued *boundhottest;
+	// the workers only ever append to arrivals, which is swapped with the
+	// empty received whenever the drawing side takes the tiles in; arrivemutex
+	// guards dirty as well, which the workers set as they append
 	bool dirty;
+	std::unique_ptr<mapctrl::mutex> arrivemutex;
+	std::vector<arrival> arrivals;
+	std::vector<arrival> received;
+	std::pair<unsigned int, double> lockwait;
 	std::unique_ptr<mapctrl::mutex> quemutex;
 	std::unique_ptr<mapctrl::condvar> quecond;
-	std::map<mapctrl::quadkey, unsigned int> requested;
+	requestqueue requested;
+	std::map<mapctrl::quadkey, requestqueue::iterator> requestindex;
+	std::set<mapctrl::quadkey> loading;
+	// the files read most recently, whatever the style, which the workers
+	// share under encodedmutex; encodedorder lists them from the least recently used
+	const size_t maxencodedbytes;
+	std::unique_ptr<mapctrl::mutex> encodedmutex;
+	std::map<encodedkey, encodedtile> encoded;
+	std::map<unsigned int, encodedkey> encodedorder;
+	unsigned int encodedclock;
+	size_t numencodedbytes;
+	std::pair<unsigned int, unsigned int> numencodedhits;
+	int focuslod;
+	std::pair<double, double> focus;
+	int focustimestamp;
+	int prefetchtimestamp;
+	unsigned int generation;
+	unsigned int numskipped;
+	unsigned int numdiscarded;
 #ifdef USE_OPENGL
+	// outlives useless, whose textures give their slots back on destruction
+	std::unique_ptr<tileatlas> atlas;
+#endif
+#if defined USE_OPENGL || defined PLATFORM_HEADLESS
 	std::vector<std::unique_ptr<pngtexture>> useless;
 #endif
 	tileloadedhandler on_tileloaded;
 
-	void clear();
+	pngtexture * load(const mapctrl::quadkey &key, mapctrl::mapcontrol::mapstyle style);
+	bool find_encoded(const mapctrl::quadkey &key, mapctrl::mapcontrol::mapstyle style, std::vector<unsigned char> &bytes);
+	void keep_encoded(const mapctrl::quadkey &key, mapctrl::mapcontrol::mapstyle style, const void *data, unsigned int size);
+	void lock_measured(mapctrl::mutex &m);
+	void receive_tiles();
+	void set_dirty();
+	void touch_bound(pngtexture_queued *texqd, int timestamp);
+	void unlink_bound(pngtexture_queued *texqd);
+	void unbind_coldest(int timestamp);
+	std::pair<mapctrl::quadkey, const pngtexture *> find_texture(const mapctrl::quadkey &key, int timestamp);
+	void add_missing(const mapctrl::quadkey &key, int timestamp);
+	void request_missing(int timestamp, bool prefetched);
+	void enqueue(const mapctrl::quadkey &key, int timestamp, bool prefetched, bool fallback = false);
+	void clear(const mapctrl::mapcontrol::mapstyle *style = nullptr);
 };
@@ -64,6 +64,11 @@ int quadkey::get_lod() const
 	return static_cast<int>(this->len);
 }
 
+quadkey::quadkey_t quadkey::get_key() const
+{
+	return this->key;
+}
+
 bool quadkey::empty() const
 {
 	return this->len == 0;
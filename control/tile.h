@@ -84,6 +84,7 @@ public:
 
 	unsigned char operator[](int index) const;
 	int get_lod() const;
+	quadkey_t get_key() const;
 	bool empty() const;
 
 	bool has_upper() const;
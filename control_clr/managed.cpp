@@ -60,12 +60,12 @@ public:
 		self = this;
 	}
 
-	void Initialize(String^ reposroot, int zoomlevel, int width, int height, double lon, double lat, int numtileslimit)
+	void Initialize(String^ reposroot, int zoomlevel, int width, int height, double lon, double lat, int cachebytes, int texturebytes, int encodedbytes)
 	{
 		auto reposrootu = marshal_as<std::string>(reposroot);
 
 		mapctrl::screenpair mapsize(width, height);
-		this->map = mapctrl::mapcontrol::create(reposrootu, zoomlevel, mapsize, numtileslimit);
+		this->map = mapctrl::mapcontrol::create(reposrootu, zoomlevel, mapsize, cachebytes, texturebytes, encodedbytes);
 
 		if (!this->map->initialize(reposrootu, on_tileupdate)) {
 			delete this->map;
@@ -17,3 +17,4 @@
 #pragma once
 
 void * read_texture(const std::string &path, GLuint *outwidth, GLuint *outheight);
+void * read_texture(const void *data, unsigned int size, GLuint *outwidth, GLuint *outheight);
@@ -16,10 +16,8 @@
 
 #include "stdafx.h"
 
-void * read_texture(const std::string &path, GLuint *outwidth, GLuint *outheight)
+static void * decode_texture(NSData *texData, GLuint *outwidth, GLuint *outheight)
 {
-    NSString *pathstr = [NSString stringWithCString:path.c_str() encoding:NSUTF8StringEncoding];
-    NSData *texData = [[NSData alloc] initWithContentsOfFile:pathstr];
     UIImage *image = [[UIImage alloc] initWithData:texData];
     if (image == nil) return nullptr;
     
@@ -34,9 +32,25 @@ void * read_texture(const std::string &path, GLuint *outwidth, GLuint *outheight
     CGContextDrawImage(context, CGRectMake(0, 0, width, height), image.CGImage);
     
     [image release];
-    [texData release];
     
     *outwidth = width;
     *outheight = height;
     return imageData;
 }
+
+void * read_texture(const std::string &path, GLuint *outwidth, GLuint *outheight)
+{
+    NSString *pathstr = [NSString stringWithCString:path.c_str() encoding:NSUTF8StringEncoding];
+    NSData *texData = [[NSData alloc] initWithContentsOfFile:pathstr];
+    void *imageData = decode_texture(texData, outwidth, outheight);
+    [texData release];
+    return imageData;
+}
+
+void * read_texture(const void *data, unsigned int size, GLuint *outwidth, GLuint *outheight)
+{
+    NSData *texData = [[NSData alloc] initWithBytesNoCopy:const_cast<void *>(data) length:size freeWhenDone:NO];
+    void *imageData = decode_texture(texData, outwidth, outheight);
+    [texData release];
+    return imageData;
+}
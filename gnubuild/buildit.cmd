@@ -4,6 +4,8 @@
 set PRE=1
 set PIXI=0
 set DEBUG=0
+@rem Set to 1 to draw with OpenGL ES 2 shaders (not on Pixi)
+set GLES2=0
 
 @rem List your source files here
 set SRC=..\control\file.cpp ..\control\map.cpp ..\control\render.cpp ..\control\repository.cpp ..\control\tile.cpp ..\pdk\main.cpp
@@ -30,6 +32,11 @@ if %PIXI% equ 1 (
    set DEVICEOPTS=%DEVICEOPTS% -mcpu=arm1136jf-s -mfpu=vfp -mfloat-abi=softfp
 )
 
+if %GLES2% equ 1 (
+   set DEVICEOPTS=%DEVICEOPTS% -DUSE_GLES2
+   set LIBS=-lSDL_image -lSDL -lGLESv2 -lpdl
+)
+
 set LINDSAYINC="-I..\control" "-I..\control_pdk"
 set DEVICEOPTS=%DEVICEOPTS% -std=c++0x
 
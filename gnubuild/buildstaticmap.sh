@@ -0,0 +1,20 @@
+#!/bin/sh
+# Builds staticmap for the machine it runs on, which needs no GPU
+# Set DEBUG=1 in the environment for a debug build
+
+SRC="../control/file.cpp ../control/map.cpp ../control/render.cpp ../control/repository.cpp ../control/tile.cpp ../staticmap/main.cpp"
+LIBS="-lSDL_image -lSDL -lz -lpthread"
+OUTFILE=staticmap
+
+if [ "$DEBUG" = "1" ]; then
+	OPTS="-g"
+else
+	OPTS="-O2"
+fi
+
+LINDSAYINC="-I../control -I../control_pdk"
+OPTS="$OPTS -std=c++0x -DHEADLESS"
+
+echo $OPTS
+
+g++ $OPTS -o $OUTFILE $SRC $LINDSAYINC $(sdl-config --cflags) $LIBS
@@ -0,0 +1,720 @@
+// This file is part of bingshin.
+// 
+// bingshin is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+// 
+// bingshin is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+// more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with bingshin. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "stdafx.h"
+
+namespace config
+{
+	static const char *tilesdir = "tiles";
+	static const unsigned int combinefactor = 4;
+	static const int maxlod = 24;
+}
+
+struct tilefile
+{
+	archive::uint64 key;
+	int lod;
+	char style;
+	unsigned int size;
+	archive::uint64 hash[2];
+};
+
+struct lodstat
+{
+	lodstat()
+		: numtiles(0), numunique(0), inbytes(0), outbytes(0)
+	{
+	}
+
+	unsigned int numtiles;
+	unsigned int numunique;
+	archive::uint64 inbytes;
+	archive::uint64 outbytes;
+};
+
+// MurmurHash3 (x64, 128-bit) by Austin Appleby, placed in the public domain.
+// Two tiles are considered identical when both their sizes and hashes match.
+class contenthash
+{
+public:
+	static void compute(const unsigned char *data, size_t len, archive::uint64 *out)
+	{
+		const size_t nblocks = len / 16;
+		const archive::uint64 c1 = 0x87c37b91114253d5ULL;
+		const archive::uint64 c2 = 0x4cf5ad432745937fULL;
+		archive::uint64 h1 = 0;
+		archive::uint64 h2 = 0;
+
+		for (size_t i = 0; i < nblocks; ++i) {
+			archive::uint64 k1 = read64(data + i * 16);
+			archive::uint64 k2 = read64(data + i * 16 + 8);
+
+			k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+			h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+			k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+			h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+		}
+
+		const unsigned char *tail = data + nblocks * 16;
+		archive::uint64 k1 = 0;
+		archive::uint64 k2 = 0;
+		switch (len & 15) {
+		case 15: k2 ^= static_cast<archive::uint64>(tail[14]) << 48;
+		case 14: k2 ^= static_cast<archive::uint64>(tail[13]) << 40;
+		case 13: k2 ^= static_cast<archive::uint64>(tail[12]) << 32;
+		case 12: k2 ^= static_cast<archive::uint64>(tail[11]) << 24;
+		case 11: k2 ^= static_cast<archive::uint64>(tail[10]) << 16;
+		case 10: k2 ^= static_cast<archive::uint64>(tail[9]) << 8;
+		case 9: k2 ^= static_cast<archive::uint64>(tail[8]);
+			k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+		case 8: k1 ^= static_cast<archive::uint64>(tail[7]) << 56;
+		case 7: k1 ^= static_cast<archive::uint64>(tail[6]) << 48;
+		case 6: k1 ^= static_cast<archive::uint64>(tail[5]) << 40;
+		case 5: k1 ^= static_cast<archive::uint64>(tail[4]) << 32;
+		case 4: k1 ^= static_cast<archive::uint64>(tail[3]) << 24;
+		case 3: k1 ^= static_cast<archive::uint64>(tail[2]) << 16;
+		case 2: k1 ^= static_cast<archive::uint64>(tail[1]) << 8;
+		case 1: k1 ^= static_cast<archive::uint64>(tail[0]);
+			k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+		}
+
+		h1 ^= len; h2 ^= len;
+		h1 += h2; h2 += h1;
+		h1 = fmix(h1); h2 = fmix(h2);
+		h1 += h2; h2 += h1;
+
+		out[0] = h1;
+		out[1] = h2;
+	}
+
+private:
+	static archive::uint64 read64(const unsigned char *p)
+	{
+		archive::uint64 v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	static archive::uint64 rotl(archive::uint64 x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	static archive::uint64 fmix(archive::uint64 k)
+	{
+		k ^= k >> 33;
+		k *= 0xff51afd7ed558ccdULL;
+		k ^= k >> 33;
+		k *= 0xc4ceb9fe1a85ec53ULL;
+		k ^= k >> 33;
+		return k;
+	}
+};
+
+#ifdef _WIN32
+class workerpool
+{
+public:
+	workerpool()
+	{
+		::InitializeCriticalSection(&this->cs);
+		::InitializeConditionVariable(&this->cv);
+	}
+
+	~workerpool()
+	{
+		::DeleteCriticalSection(&this->cs);
+	}
+
+	void lock()
+	{
+		::EnterCriticalSection(&this->cs);
+	}
+
+	void unlock()
+	{
+		::LeaveCriticalSection(&this->cs);
+	}
+
+	void wait()
+	{
+		::SleepConditionVariableCS(&this->cv, &this->cs, INFINITE);
+	}
+
+	void broadcast()
+	{
+		::WakeAllConditionVariable(&this->cv);
+	}
+
+	void run(unsigned int numthreads, unsigned (__stdcall *entry)(void *data), void *data)
+	{
+		std::vector<HANDLE> handles;
+		for (unsigned int i = 0; i < numthreads; ++i)
+			handles.push_back(reinterpret_cast<HANDLE>(_beginthreadex(nullptr, 0, entry, data, 0, nullptr)));
+		for (auto i = handles.begin(); i != handles.end(); ++i) {
+			::WaitForSingleObject(*i, INFINITE);
+			::CloseHandle(*i);
+		}
+	}
+
+	static unsigned int get_numcores()
+	{
+		SYSTEM_INFO info;
+		::GetSystemInfo(&info);
+		return info.dwNumberOfProcessors;
+	}
+
+private:
+	CRITICAL_SECTION cs;
+	CONDITION_VARIABLE cv;
+};
+#define WORKER_ENTRY(name)  static unsigned __stdcall name(void *data)
+#define WORKER_RETURN  return 0
+#else
+class workerpool
+{
+public:
+	workerpool()
+	{
+		pthread_mutex_init(&this->pthmutex, NULL);
+		pthread_cond_init(&this->pthcond, NULL);
+	}
+
+	~workerpool()
+	{
+		pthread_cond_destroy(&this->pthcond);
+		pthread_mutex_destroy(&this->pthmutex);
+	}
+
+	void lock()
+	{
+		pthread_mutex_lock(&this->pthmutex);
+	}
+
+	void unlock()
+	{
+		pthread_mutex_unlock(&this->pthmutex);
+	}
+
+	void wait()
+	{
+		pthread_cond_wait(&this->pthcond, &this->pthmutex);
+	}
+
+	void broadcast()
+	{
+		pthread_cond_broadcast(&this->pthcond);
+	}
+
+	void run(unsigned int numthreads, void * (*entry)(void *data), void *data)
+	{
+		std::vector<pthread_t> handles(numthreads);
+		for (unsigned int i = 0; i < numthreads; ++i)
+			pthread_create(&handles[i], NULL, entry, data);
+		for (auto i = handles.begin(); i != handles.end(); ++i)
+			pthread_join(*i, NULL);
+	}
+
+	static unsigned int get_numcores()
+	{
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		return n > 0 ? static_cast<unsigned int>(n) : 1;
+	}
+
+private:
+	pthread_mutex_t pthmutex;
+	pthread_cond_t pthcond;
+};
+#define WORKER_ENTRY(name)  static void * name(void *data)
+#define WORKER_RETURN  return NULL
+#endif
+
+struct direntry
+{
+	std::string name;
+	bool directory;
+};
+
+static bool list_directory(const std::string &abspath, std::vector<direntry> &entries)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE h = ::FindFirstFileA(path::combine(abspath, "*").c_str(), &found);
+	if (h == INVALID_HANDLE_VALUE) return false;
+	do {
+		direntry e;
+		e.name = found.cFileName;
+		e.directory = (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+		if (e.name != "." && e.name != "..")
+			entries.push_back(e);
+	} while (::FindNextFileA(h, &found));
+	::FindClose(h);
+#else
+	DIR *dir = opendir(abspath.c_str());
+	if (!dir) return false;
+	for (struct dirent *d = readdir(dir); d; d = readdir(dir)) {
+		direntry e;
+		e.name = d->d_name;
+		if (e.name == "." || e.name == "..") continue;
+
+		if (d->d_type == DT_UNKNOWN || d->d_type == DT_LNK) {
+			struct stat st;
+			if (stat(path::combine(abspath, e.name).c_str(), &st) != 0) continue;
+			e.directory = S_ISDIR(st.st_mode);
+		}
+		else
+			e.directory = d->d_type == DT_DIR;
+		entries.push_back(e);
+	}
+	closedir(dir);
+#endif
+	return true;
+}
+
+static bool read_file(const std::string &abspath, std::vector<unsigned char> &buffer)
+{
+	FILE *fp = std::fopen(abspath.c_str(), "rb");
+	if (!fp) return false;
+
+	buffer.clear();
+	unsigned char chunk[16384];
+	for (; ; ) {
+		size_t count = std::fread(chunk, 1, sizeof(chunk), fp);
+		if (count == 0) break;
+		buffer.insert(buffer.end(), chunk, chunk + count);
+	}
+	bool ok = !std::ferror(fp);
+	std::fclose(fp);
+	return ok;
+}
+
+static bool is_keydigits(const std::string &s, size_t len)
+{
+	if (len == 0 || len > s.length()) return false;
+	for (size_t i = 0; i < len; ++i) {
+		if (s[i] < '0' || s[i] > '3') return false;
+	}
+	return true;
+}
+
+static archive::uint64 parse_key(const std::string &digits)
+{
+	archive::uint64 key = 0;
+	for (auto i = digits.begin(); i != digits.end(); ++i) {
+		key <<= 2;
+		key |= *i - '0';
+	}
+	return key;
+}
+
+// Converts a loose tile tree, laid out by repository::get_relativepath, into
+// one packed archive per style and LOD. In index-only mode the tiles stay
+// loose and only their sorted keys are written, so that the control can tell
+// missing tiles without touching the file system.
+class packer
+{
+public:
+	packer(const std::string &rootdir, unsigned int numthreads, bool indexonly)
+		: rootdir(rootdir), numthreads(numthreads), indexonly(indexonly), numbusy(0), numskipped(0), numfailed(0)
+	{
+	}
+
+	bool scan()
+	{
+		auto tilesdir = path::combine(this->rootdir, config::tilesdir);
+		if (!file::exists(tilesdir)) {
+			std::cerr << "cannot find " << tilesdir << std::endl;
+			return false;
+		}
+
+		this->pending.push_back(std::make_pair(tilesdir, std::string()));
+		this->pool.run(this->numthreads, scan_entry, this);
+
+		if (this->numfailed) {
+			std::cerr << this->numfailed << " files could not be read" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool write()
+	{
+		auto packdir = path::combine(this->rootdir, archive::dirname);
+		if (!make_directory(packdir)) {
+			std::cerr << "cannot create " << packdir << std::endl;
+			return false;
+		}
+
+		for (auto i = this->shards.begin(); i != this->shards.end(); ++i)
+			this->writing.push_back(i->first);
+		this->pool.run(std::min<unsigned int>(this->numthreads, static_cast<unsigned int>(this->writing.size())), write_entry, this);
+
+		return this->numfailed == 0;
+	}
+
+	void print_statistics() const
+	{
+		std::cout << std::setw(6) << "style" << std::setw(5) << "lod" << std::setw(12) << "tiles" << std::setw(12) << "unique" << std::setw(16) << "input" << std::setw(16) << "output" << std::setw(8) << "ratio" << std::endl;
+
+		lodstat total;
+		for (auto i = this->stats.begin(); i != this->stats.end(); ++i) {
+			auto &st = i->second;
+			print_row(std::string(1, i->first.first), i->first.second, st);
+
+			total.numtiles += st.numtiles;
+			total.numunique += st.numunique;
+			total.inbytes += st.inbytes;
+			total.outbytes += st.outbytes;
+		}
+		print_row("total", 0, total);
+
+		if (this->numskipped)
+			std::cout << this->numskipped << " unrecognized files skipped" << std::endl;
+	}
+
+private:
+	typedef std::pair<char, int> shardkey;
+
+	const std::string rootdir;
+	const unsigned int numthreads;
+	const bool indexonly;
+	workerpool pool;
+	std::vector<std::pair<std::string, std::string>> pending;
+	unsigned int numbusy;
+	unsigned int numskipped;
+	unsigned int numfailed;
+	std::map<shardkey, std::vector<tilefile>> shards;
+	std::vector<shardkey> writing;
+	std::map<shardkey, lodstat> stats;
+
+	WORKER_ENTRY(scan_entry)
+	{
+		static_cast<packer *>(data)->scan_worker();
+		WORKER_RETURN;
+	}
+
+	WORKER_ENTRY(write_entry)
+	{
+		static_cast<packer *>(data)->write_worker();
+		WORKER_RETURN;
+	}
+
+	void scan_worker()
+	{
+		std::map<shardkey, std::vector<tilefile>> found;
+		std::vector<unsigned char> buffer;
+		unsigned int skipped = 0;
+		unsigned int failed = 0;
+
+		this->pool.lock();
+		for (; ; ) {
+			while (this->pending.empty() && this->numbusy > 0)
+				this->pool.wait();
+			if (this->pending.empty()) break;
+
+			auto dir = this->pending.back();
+			this->pending.pop_back();
+			this->numbusy++;
+			this->pool.unlock();
+
+			std::vector<direntry> entries;
+			std::vector<std::pair<std::string, std::string>> subdirs;
+			list_directory(dir.first, entries);
+
+			for (auto i = entries.begin(); i != entries.end(); ++i) {
+				auto abspath = path::combine(dir.first, i->name);
+				if (i->directory) {
+					if (i->name.length() == config::combinefactor && is_keydigits(i->name, config::combinefactor))
+						subdirs.push_back(std::make_pair(abspath, dir.second + i->name));
+					else
+						skipped++;
+					continue;
+				}
+
+				tilefile tile;
+				if (!this->parse_filename(dir.second, i->name, tile)) {
+					skipped++;
+					continue;
+				}
+
+				if (this->indexonly) {
+					tile.size = 0;
+					tile.hash[0] = tile.hash[1] = 0;
+				}
+				else if (!read_file(abspath, buffer)) {
+					failed++;
+					continue;
+				}
+				else {
+					tile.size = static_cast<unsigned int>(buffer.size());
+					contenthash::compute(buffer.empty() ? nullptr : &buffer[0], buffer.size(), tile.hash);
+				}
+				found[shardkey(tile.style, tile.lod)].push_back(tile);
+			}
+
+			this->pool.lock();
+			this->pending.insert(this->pending.end(), subdirs.begin(), subdirs.end());
+			this->numbusy--;
+			this->pool.broadcast();
+		}
+
+		for (auto i = found.begin(); i != found.end(); ++i) {
+			auto &shard = this->shards[i->first];
+			shard.insert(shard.end(), i->second.begin(), i->second.end());
+		}
+		this->numskipped += skipped;
+		this->numfailed += failed;
+		this->pool.unlock();
+	}
+
+	bool parse_filename(const std::string &prefix, const std::string &name, tilefile &tile) const
+	{
+		auto underscore = name.find('_');
+		if (underscore == std::string::npos || underscore > config::combinefactor) return false;
+		if (!is_keydigits(name, underscore)) return false;
+		if (underscore + 1 >= name.length()) return false;
+
+		auto suffix = name.substr(underscore + 1);
+		if (suffix == "r.png_")
+			tile.style = 'r';
+		else if (suffix == "h.jpeg_")
+			tile.style = 'h';
+		else
+			return false;
+
+		auto digits = prefix + name.substr(0, underscore);
+		if (digits.length() >= static_cast<size_t>(config::maxlod)) return false;
+
+		tile.key = parse_key(digits);
+		tile.lod = static_cast<int>(digits.length());
+		return true;
+	}
+
+	std::string get_tilepath(const tilefile &tile) const
+	{
+		std::ostringstream s;
+		for (int i = tile.lod - 1; i >= 0; --i) {
+			int index = tile.lod - 1 - i;
+			if (index > 0 && (index % config::combinefactor == 0))
+				s << path::separator;
+			s << static_cast<char>('0' + ((tile.key >> (i * 2)) & 3));
+		}
+		s << '_' << (tile.style == 'r' ? "r.png_" : "h.jpeg_");
+		return path::combine(path::combine(this->rootdir, config::tilesdir), s.str());
+	}
+
+	void write_worker()
+	{
+		this->pool.lock();
+		while (!this->writing.empty()) {
+			auto key = this->writing.back();
+			this->writing.pop_back();
+			auto &tiles = this->shards[key];
+			this->pool.unlock();
+
+			lodstat st;
+			bool ok = this->indexonly ? this->write_index(key, tiles, st) : this->write_shard(key, tiles, st);
+
+			this->pool.lock();
+			this->stats[key] = st;
+			if (!ok) this->numfailed++;
+		}
+		this->pool.unlock();
+	}
+
+	struct samecontent
+	{
+		bool operator()(const tilefile &l, const tilefile &r) const
+		{
+			if (l.size != r.size) return l.size < r.size;
+			if (l.hash[0] != r.hash[0]) return l.hash[0] < r.hash[0];
+			return l.hash[1] < r.hash[1];
+		}
+	};
+
+	static bool by_key(const tilefile &l, const tilefile &r)
+	{
+		return l.key < r.key;
+	}
+
+	bool write_shard(const shardkey &key, std::vector<tilefile> &tiles, lodstat &st)
+	{
+		std::sort(tiles.begin(), tiles.end(), by_key);
+
+		archive::header head;
+		std::memcpy(head.signature, archive::signature, sizeof(head.signature));
+		head.version = archive::version;
+		head.lod = key.second;
+		head.style = key.first;
+		head.numentries = static_cast<unsigned int>(tiles.size());
+		head.flags = 0;
+		head.dataoffset = sizeof(archive::header) + sizeof(archive::entry) * static_cast<archive::uint64>(tiles.size());
+
+		std::vector<archive::entry> entries(tiles.size());
+		std::vector<const tilefile *> unique;
+		std::map<tilefile, archive::uint64, samecontent> stored;
+		archive::uint64 offset = head.dataoffset;
+
+		for (size_t i = 0; i < tiles.size(); ++i) {
+			auto &tile = tiles[i];
+			st.numtiles++;
+			st.inbytes += tile.size;
+
+			auto found = stored.find(tile);
+			if (found == stored.end()) {
+				found = stored.insert(std::make_pair(tile, offset)).first;
+				unique.push_back(&tile);
+				offset += tile.size;
+				st.numunique++;
+			}
+
+			entries[i].key = tile.key;
+			entries[i].offset = found->second;
+			entries[i].size = tile.size;
+			entries[i].reserved = 0;
+		}
+		st.outbytes = offset;
+
+		auto packpath = path::combine(path::combine(this->rootdir, archive::dirname), archive::get_filename(key.first, key.second));
+		auto tmppath = packpath + ".tmp";
+
+		FILE *fp = std::fopen(tmppath.c_str(), "wb");
+		if (!fp) {
+			std::cerr << "cannot create " << tmppath << std::endl;
+			return false;
+		}
+
+		bool ok = std::fwrite(&head, sizeof(head), 1, fp) == 1;
+		if (ok && !entries.empty())
+			ok = std::fwrite(&entries[0], sizeof(archive::entry), entries.size(), fp) == entries.size();
+
+		std::vector<unsigned char> buffer;
+		for (auto i = unique.begin(); ok && i != unique.end(); ++i) {
+			auto tilepath = this->get_tilepath(**i);
+			if (!read_file(tilepath, buffer) || buffer.size() != (*i)->size) {
+				std::cerr << tilepath << " changed while packing" << std::endl;
+				ok = false;
+				break;
+			}
+			if (!buffer.empty())
+				ok = std::fwrite(&buffer[0], 1, buffer.size(), fp) == buffer.size();
+		}
+
+		if (std::fclose(fp) != 0) ok = false;
+		if (ok) {
+			std::remove(packpath.c_str());
+			ok = std::rename(tmppath.c_str(), packpath.c_str()) == 0;
+		}
+		if (!ok) {
+			std::remove(tmppath.c_str());
+			std::cerr << "failed to write " << packpath << std::endl;
+		}
+		return ok;
+	}
+
+	bool write_index(const shardkey &key, std::vector<tilefile> &tiles, lodstat &st)
+	{
+		std::sort(tiles.begin(), tiles.end(), by_key);
+
+		archive::header head;
+		std::memcpy(head.signature, archive::signature, sizeof(head.signature));
+		head.version = archive::version;
+		head.lod = key.second;
+		head.style = key.first;
+		head.numentries = static_cast<unsigned int>(tiles.size());
+		head.flags = archive::INDEXONLY;
+		head.dataoffset = sizeof(archive::header) + sizeof(archive::uint64) * static_cast<archive::uint64>(tiles.size());
+
+		std::vector<archive::uint64> keys(tiles.size());
+		for (size_t i = 0; i < tiles.size(); ++i)
+			keys[i] = tiles[i].key;
+		st.numtiles = st.numunique = static_cast<unsigned int>(tiles.size());
+		st.outbytes = head.dataoffset;
+
+		auto idxpath = path::combine(path::combine(this->rootdir, archive::dirname), archive::get_filename(key.first, key.second, true));
+		auto tmppath = idxpath + ".tmp";
+
+		FILE *fp = std::fopen(tmppath.c_str(), "wb");
+		if (!fp) {
+			std::cerr << "cannot create " << tmppath << std::endl;
+			return false;
+		}
+
+		bool ok = std::fwrite(&head, sizeof(head), 1, fp) == 1;
+		if (ok && !keys.empty())
+			ok = std::fwrite(&keys[0], sizeof(archive::uint64), keys.size(), fp) == keys.size();
+
+		if (std::fclose(fp) != 0) ok = false;
+		if (ok) {
+			std::remove(idxpath.c_str());
+			ok = std::rename(tmppath.c_str(), idxpath.c_str()) == 0;
+		}
+		if (!ok) {
+			std::remove(tmppath.c_str());
+			std::cerr << "failed to write " << idxpath << std::endl;
+		}
+		return ok;
+	}
+
+	static void print_row(const std::string &style, int lod, const lodstat &st)
+	{
+		double ratio = st.outbytes ? static_cast<double>(st.inbytes) / st.outbytes : 0.0;
+		std::cout << std::setw(6) << style << std::setw(5);
+		if (lod) std::cout << lod;
+		else std::cout << '-';
+		std::cout << std::setw(12) << st.numtiles << std::setw(12) << st.numunique << std::setw(16) << st.inbytes << std::setw(16) << st.outbytes << std::setw(8) << std::fixed << std::setprecision(2) << ratio << std::endl;
+	}
+
+	static bool make_directory(const std::string &abspath)
+	{
+		if (file::exists(abspath)) return true;
+#ifdef _WIN32
+		return ::CreateDirectoryA(abspath.c_str(), nullptr) != 0;
+#else
+		return mkdir(abspath.c_str(), 0755) == 0;
+#endif
+	}
+};
+
+int main(int argc, char **argv)
+{
+	bool indexonly = argc > 1 && std::string(argv[1]) == "--index-only";
+	if (indexonly) {
+		argc--;
+		argv++;
+	}
+
+	if (argc < 2 || argc > 3) {
+		std::cerr << "usage: packer [--index-only] <repository root> [number of threads]" << std::endl;
+		return 1;
+	}
+
+	std::string rootdir(argv[1]);
+	unsigned int numthreads = workerpool::get_numcores();
+	if (argc == 3) {
+		std::istringstream is(argv[2]);
+		is >> numthreads;
+		if (!numthreads) numthreads = 1;
+	}
+
+	packer p(rootdir, numthreads, indexonly);
+	if (!p.scan()) return 1;
+	if (!p.write()) return 1;
+
+	p.print_statistics();
+	return 0;
+}
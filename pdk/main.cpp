@@ -39,7 +39,12 @@ namespace config
 	static const int screenwidth = 320;
 	static const int screenheight = 400;
 
-	static const int numtileslimit = 30;
+	// about 30 RGBA tiles
+	static const size_t cachebytes = 8 << 20;
+	// about 15, the screen twice over while zooming
+	static const size_t texturebytes = 4 << 20;
+	// a few hundred tile files, as read from the flash
+	static const size_t encodedbytes = 4 << 20;
 
 	namespace location
 	{
@@ -257,6 +262,16 @@ public:
 
 	bool initialize(const mapctrl::screenpair &mapsize)
 	{
+#ifdef USE_GLES2
+		// the renderer sets up its own projection in its shaders
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
+
+		this->screen = SDL_SetVideoMode(0, 0, 0, SDL_OPENGL);
+
+		glDisable(GL_DEPTH_TEST);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+#else
 		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 1);
 
 		this->screen = SDL_SetVideoMode(0, 0, 0, SDL_OPENGL);
@@ -270,8 +285,9 @@ public:
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		glDisable(GL_ALPHA_TEST);
+#endif
 
-		this->map = mapctrl::mapcontrol::create(config::reposroot, config::zoomlevel, mapsize, config::numtileslimit);
+		this->map = mapctrl::mapcontrol::create(config::reposroot, config::zoomlevel, mapsize, config::cachebytes, config::texturebytes, config::encodedbytes);
 
 		return this->prepare();
 	}
@@ -310,8 +326,10 @@ private:
 		bool drawn = false;
 
 		if (force || this->map->needs_draw()) {
+#ifndef USE_GLES2
 			glMatrixMode(GL_MODELVIEW);
 			glLoadIdentity();
+#endif
 
 			glClear(GL_COLOR_BUFFER_BIT);
 
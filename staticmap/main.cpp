@@ -0,0 +1,378 @@
+// This file is part of bingshin.
+//
+// bingshin is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// bingshin is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+// more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bingshin. If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Renders static maps from an offline repository into PNG files, without a
+// GPU. Every line of the job file describes one map:
+//
+//   <longitude> <latitude> <zoom level> <width> <height> <road|hybrid> <output PNG>
+//
+// Empty lines and lines starting with '#' are skipped. The jobs are drawn by
+// one thread per core, all sharing a single tile cache, so neighbouring maps
+// decode their tiles once. Jobs of one style are drawn before the other, as
+// the cache holds one style at a time.
+//
+//   staticmap <repository root> <job file> [number of threads]
+
+#include "stdafx.h"
+#include <fstream>
+#include <zlib.h>
+
+using namespace mapctrl;
+
+namespace config
+{
+	static const unsigned int tilesize = 256;
+	static const size_t cachebytes = 1 << 30;
+	// over many jobs the decoded tiles are evicted, and a tile shared by jobs
+	// far apart in the list would be read again; its file takes a fraction of
+	// the decoded size, so many more of them are kept to spare the read
+	static const size_t encodedbytes = 256 << 20;
+
+	// how often a job looks for the tiles it is waiting for
+	static const Uint32 pollinterval = 5;
+	// a job is given up when its tiles have not all arrived by then
+	static const Uint32 jobtimeout = 30000;
+}
+
+struct job
+{
+	job(const lonlat &center, int zoomlevel, const screenpair &size, mapcontrol::mapstyle style, const std::string &outpath, int lineno)
+		: center(center), zoomlevel(zoomlevel), size(size), style(style), outpath(outpath), lineno(lineno)
+	{
+	}
+
+	lonlat center;
+	int zoomlevel;
+	screenpair size;
+	mapcontrol::mapstyle style;
+	std::string outpath;
+	int lineno;
+};
+
+static bool by_style(const job &l, const job &r)
+{
+	return l.style < r.style;
+}
+
+struct otherstyle
+{
+	otherstyle(mapcontrol::mapstyle style)
+		: style(style)
+	{
+	}
+
+	bool operator()(const job &j) const
+	{
+		return j.style != this->style;
+	}
+
+	mapcontrol::mapstyle style;
+};
+
+// textures thrown out of the cache are destroyed only when no thread is drawing
+class framegate
+{
+public:
+	framegate(tilecache *tiles)
+		: tiles(tiles), lock(mutex::create()), numdrawing(0)
+	{
+	}
+
+	void enter()
+	{
+		this->lock->lock();
+		this->numdrawing++;
+		this->lock->unlock();
+	}
+
+	void leave()
+	{
+		this->lock->lock();
+		if (--this->numdrawing == 0)
+			this->tiles->destroy_useless_textures();
+		this->lock->unlock();
+	}
+
+private:
+	tilecache *tiles;
+	std::unique_ptr<mutex> lock;
+	unsigned int numdrawing;
+};
+
+struct jobqueue
+{
+	jobqueue(tilecache *tiles, const std::vector<job> &jobs)
+		: tiles(tiles), gate(tiles), jobs(jobs), lock(mutex::create()), next(0), timestamp(0), numdone(0), numfailed(0)
+	{
+	}
+
+	tilecache *tiles;
+	framegate gate;
+	const std::vector<job> &jobs;
+	std::unique_ptr<mutex> lock;
+	size_t next;
+	int timestamp;
+	unsigned int numdone;
+	unsigned int numfailed;
+
+	const job * take()
+	{
+		const job *taken = nullptr;
+		this->lock->lock();
+		if (this->next < this->jobs.size())
+			taken = &this->jobs[this->next++];
+		this->lock->unlock();
+		return taken;
+	}
+
+	int next_timestamp()
+	{
+		this->lock->lock();
+		int ts = ++this->timestamp;
+		this->lock->unlock();
+		return ts;
+	}
+
+	void finish(bool successful)
+	{
+		this->lock->lock();
+		if (successful)
+			this->numdone++;
+		else
+			this->numfailed++;
+		this->lock->unlock();
+	}
+};
+
+static bool parse_style(const std::string &name, mapcontrol::mapstyle *style)
+{
+	if (name == "road")
+		*style = mapcontrol::ROAD;
+	else if (name == "hybrid")
+		*style = mapcontrol::HYBRID;
+	else
+		return false;
+	return true;
+}
+
+static bool read_jobs(const std::string &path, std::vector<job> &jobs)
+{
+	std::ifstream input(path.c_str());
+	if (!input) {
+		std::cerr << "cannot open " << path << std::endl;
+		return false;
+	}
+
+	std::string line;
+	for (int lineno = 1; std::getline(input, line); ++lineno) {
+		auto first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#') continue;
+
+		std::istringstream fields(line);
+		double lon = 0.0, lat = 0.0;
+		int zoomlevel = 0, width = 0, height = 0;
+		std::string stylename, outpath;
+		fields >> lon >> lat >> zoomlevel >> width >> height >> stylename >> outpath;
+
+		mapcontrol::mapstyle style;
+		if (!fields || !parse_style(stylename, &style) || zoomlevel < 1 || width <= 0 || height <= 0) {
+			std::cerr << path << ":" << lineno << ": invalid job" << std::endl;
+			return false;
+		}
+		jobs.push_back(job(lonlat(lon, lat), zoomlevel, screenpair(width, height), style, outpath, lineno));
+	}
+	return true;
+}
+
+static void put_uint32(std::vector<unsigned char> &out, unsigned long value)
+{
+	out.push_back(static_cast<unsigned char>(value >> 24));
+	out.push_back(static_cast<unsigned char>(value >> 16));
+	out.push_back(static_cast<unsigned char>(value >> 8));
+	out.push_back(static_cast<unsigned char>(value));
+}
+
+static void put_chunk(std::ofstream &output, const char *type, const std::vector<unsigned char> &data)
+{
+	std::vector<unsigned char> chunk;
+	put_uint32(chunk, static_cast<unsigned long>(data.size()));
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+
+	uLong crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, &chunk[4], static_cast<uInt>(chunk.size() - 4));
+	put_uint32(chunk, crc);
+
+	output.write(reinterpret_cast<const char *>(&chunk[0]), chunk.size());
+}
+
+// the map is opaque, so only the color goes into the file
+static bool write_png(const std::string &path, const unsigned char *rgba, const screenpair &size)
+{
+	std::vector<unsigned char> raw;
+	raw.reserve((size.x * 3 + 1) * size.y);
+	for (int y = 0; y < size.y; ++y) {
+		raw.push_back(0);
+		auto row = rgba + y * size.x * 4;
+		for (int x = 0; x < size.x; ++x, row += 4)
+			raw.insert(raw.end(), row, row + 3);
+	}
+
+	uLongf numcompressed = compressBound(static_cast<uLong>(raw.size()));
+	std::vector<unsigned char> compressed(numcompressed);
+	if (compress2(&compressed[0], &numcompressed, &raw[0], static_cast<uLong>(raw.size()), Z_DEFAULT_COMPRESSION) != Z_OK)
+		return false;
+	compressed.resize(numcompressed);
+
+	std::vector<unsigned char> header;
+	put_uint32(header, size.x);
+	put_uint32(header, size.y);
+	// 8 bits per channel, truecolor, deflate, no filter method, no interlace
+	const unsigned char format[] = { 8, 2, 0, 0, 0 };
+	header.insert(header.end(), format, format + sizeof(format));
+
+	std::ofstream output(path.c_str(), std::ios::binary);
+	if (!output) return false;
+
+	static const unsigned char signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	output.write(reinterpret_cast<const char *>(signature), sizeof(signature));
+	put_chunk(output, "IHDR", header);
+	put_chunk(output, "IDAT", compressed);
+	put_chunk(output, "IEND", std::vector<unsigned char>());
+	return !!output;
+}
+
+static bool is_resolved(tilecache *tiles, const tilelayer &layer, int timestamp)
+{
+	for (auto i = layer.visible(); i.movenext(); ) {
+		if (!tiles->is_resolved(layer.get_quadkey(i.currenttile()), timestamp))
+			return false;
+	}
+	return true;
+}
+
+// asks for the tiles until all of them are in, then draws the map once
+static bool render_job(jobqueue &queue, renderer *render, const job &j)
+{
+	tilelayer layer(j.zoomlevel);
+	layer.set_map(j.zoomlevel, layer.get_pixel(j.center), j.size);
+
+	Uint32 start = SDL_GetTicks();
+	for (bool drawn = false; !drawn; ) {
+		if (SDL_GetTicks() - start > config::jobtimeout)
+			return false;
+
+		int timestamp = queue.next_timestamp();
+		queue.gate.enter();
+		{
+			render->draw_layer(timestamp, queue.tiles, j.size, layer, nullptr, false);
+			if (is_resolved(queue.tiles, layer, timestamp)) {
+				render->begin_frame(j.size);
+				render->draw_layer(timestamp, queue.tiles, j.size, layer, nullptr, true);
+				drawn = true;
+			}
+		}
+		queue.gate.leave();
+
+		if (!drawn)
+			SDL_Delay(config::pollinterval);
+	}
+
+	screenpair size(0, 0);
+	auto pixels = render->get_framebuffer(&size);
+	return pixels && write_png(j.outpath, pixels, size);
+}
+
+static int worker_entry(void *data)
+{
+	auto queue = static_cast<jobqueue *>(data);
+	std::unique_ptr<renderer> render(renderer::create(static_cast<short>(config::tilesize), renderer::SOFTWARE));
+
+	while (auto j = queue->take()) {
+		bool successful = render_job(*queue, render.get(), *j);
+		if (!successful)
+			std::cerr << "line " << j->lineno << ": cannot render " << j->outpath << std::endl;
+		queue->finish(successful);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3 || argc > 4) {
+		std::cerr << "usage: staticmap <repository root> <job file> [number of threads]" << std::endl;
+		return 1;
+	}
+
+	std::string rootdir(argv[1]);
+	unsigned int numthreads = argc == 4 ? std::atoi(argv[3]) : thread::get_numcores();
+	if (numthreads == 0) {
+		std::cerr << "invalid arguments" << std::endl;
+		return 1;
+	}
+
+	std::vector<job> jobs;
+	if (!read_jobs(argv[2], jobs))
+		return 1;
+
+	// one style after the other, since changing it empties the cache
+	std::stable_sort(jobs.begin(), jobs.end(), by_style);
+
+	if (SDL_Init(SDL_INIT_TIMER) < 0) {
+		std::cerr << "cannot initialize SDL" << std::endl;
+		return 1;
+	}
+
+	unsigned int numdone = 0, numfailed = 0;
+	std::pair<unsigned int, double> lockwait;
+	Uint32 start = SDL_GetTicks();
+	{
+		tilecache tiles(rootdir, config::tilesize, config::cachebytes, config::cachebytes, config::encodedbytes);
+		tiles.initialize(nullptr);
+
+		for (auto first = jobs.begin(); first != jobs.end(); ) {
+			auto last = std::find_if(first, jobs.end(), otherstyle(first->style));
+			std::vector<job> group(first, last);
+			first = last;
+
+			tiles.set_mode(group.front().style);
+
+			jobqueue queue(&tiles, group);
+			std::vector<thread *> workers;
+			for (unsigned int i = 0; i < numthreads; ++i)
+				workers.push_back(thread::create(worker_entry, &queue));
+			for (auto i = workers.begin(); i != workers.end(); ++i) {
+				(*i)->waitjoin();
+				delete *i;
+			}
+
+			numdone += queue.numdone;
+			numfailed += queue.numfailed;
+		}
+
+		lockwait = tiles.get_lockwait();
+	}
+	Uint32 elapsed = SDL_GetTicks() - start;
+
+	std::cout << numdone << " maps rendered, " << numfailed << " failed in " << elapsed << " ms";
+	if (elapsed)
+		std::cout << " (" << std::fixed << std::setprecision(1) << numdone * 1000.0 / elapsed << " maps/s)";
+	std::cout << std::endl;
+	std::cout << lockwait.first << " cache locks, " << std::fixed << std::setprecision(1) << lockwait.second * 1000.0 << " ms waited" << std::endl;
+
+	SDL_Quit();
+	return numfailed ? 1 : 0;
+}
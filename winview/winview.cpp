@@ -34,7 +34,12 @@ namespace config
 	static const int screenwidth = 1024;
 	static const int screenheight = 700;
 
-	static const int numtileslimit = 100;
+	// about 100 RGBA tiles
+	static const size_t cachebytes = 25 << 20;
+	// about 60, the screen twice over while zooming
+	static const size_t texturebytes = 16 << 20;
+	// a few hundred tile files, as read from the disk
+	static const size_t encodedbytes = 8 << 20;
 
 	namespace location
 	{
@@ -117,7 +122,7 @@ public:
 //		glEnable(GL_BLEND);
 //		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-		this->map = mapctrl::mapcontrol::create(config::reposroot, config::zoomlevel, mapsize, config::numtileslimit);
+		this->map = mapctrl::mapcontrol::create(config::reposroot, config::zoomlevel, mapsize, config::cachebytes, config::texturebytes, config::encodedbytes);
 
 		return this->prepare();
 	}